@@ -0,0 +1,396 @@
+// benchmark firmware for mcli and mprintf. Build it with "make bench".
+// it times the hot paths with the DWT cycle counter and prints a table over the UART.
+// this file replaces src/main.c, and includes src/mcli.c directly so the internal
+// (static) functions can be timed on their own.
+#include "../src/mcli.c"
+
+#include "stm32wlxx.h"
+
+#include "stm32wlxx_ll_bus.h"
+#include "stm32wlxx_ll_rcc.h"
+#include "stm32wlxx_ll_gpio.h"
+#include "stm32wlxx_ll_lpuart.h"
+#include "stm32wlxx_ll_utils.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+// every measurement is repeated BENCH_RUNS times and the fastest run is reported
+// this filters out the occasional interrupt or flash wait state
+#define BENCH_RUNS        16
+// largest block size used when timing the memory functions
+#define BENCH_MAX_BYTES   256
+// how many characters are typed when timing cli_process(), at most 64. All of them have to fit in the
+// default session's rxBuffer, which holds 1 less than RX_BUFFER_SIZE, and half as many again are
+// inserted mid-line after them, so 1.5 times as many have to fit in its cmdBuffer
+#define BENCH_LINE_MAX    64
+#define BENCH_LINE_RX     (RX_BUFFER_SIZE - 1)
+#define BENCH_LINE_CMD    (((CMD_BUFFER_SIZE - 1) * 2) / 3)
+#define BENCH_LINE_LEN    ((BENCH_LINE_RX < BENCH_LINE_CMD) ? \
+                           ((BENCH_LINE_RX < BENCH_LINE_MAX) ? BENCH_LINE_RX : BENCH_LINE_MAX) : \
+                           ((BENCH_LINE_CMD < BENCH_LINE_MAX) ? BENCH_LINE_CMD : BENCH_LINE_MAX))
+#define BENCH_HALF_LEN    (BENCH_LINE_LEN / 2)
+_Static_assert(BENCH_HALF_LEN >= 2, "RX_BUFFER_SIZE and CMD_BUFFER_SIZE are too small for the cli_process() benchmark");
+
+// TIME_CYCLES(result, code) runs code BENCH_RUNS times, and stores the fewest cycles it took in result
+// the time it takes to read the cycle counter is subtracted out
+// code can set start_ = DWT->CYCCNT after its setup to leave the setup out of the measurement
+#define TIME_CYCLES(result, code) do { \
+  uint32_t best_ = UINT32_MAX; \
+  for(uint32_t run_ = 0; run_ < BENCH_RUNS; run_++){ \
+    uint32_t start_ = DWT->CYCCNT; \
+    code; \
+    uint32_t cycles_ = DWT->CYCCNT - start_; \
+    if(cycles_ < best_){ \
+      best_ = cycles_; \
+    } \
+  } \
+  (result) = (best_ > timer_overhead) ? (best_ - timer_overhead) : 0; \
+} while(0)
+
+static void UART_init(void);
+static void sysclk_init(void);
+static void cycle_counter_init(void);
+
+static void bench_cli_process(void);
+static void bench_commands(void);
+static void bench_vsnprintf(void);
+static void bench_memory(void);
+static void feed_cli(const char *str);
+
+extern uint32_t _vector_table_offset;
+
+// while muted, everything printed is thrown away so the UART doesn't slow down the measurement
+static bool muted = false;
+// how many cycles it takes just to read the cycle counter twice
+static uint32_t timer_overhead = 0;
+
+// source and destination blocks for the memory benchmarks
+// the extra bytes leave room to test every alignment
+static uint8_t __attribute__((aligned(4))) src_block[BENCH_MAX_BYTES + 4];
+static uint8_t __attribute__((aligned(4))) dest_block[BENCH_MAX_BYTES + 4];
+
+int main(void)
+{
+  SCB->VTOR = (uint32_t)(&_vector_table_offset);  // set the vector table offset
+  sysclk_init();
+  UART_init();
+  cycle_counter_init();
+
+  print_newline();
+  puts_("mcli benchmark ");
+  println_(VERSION);
+  printfln_("core clock: %u Hz, best of %u runs, cycle counter overhead removed", SystemCoreClock, BENCH_RUNS);
+
+  bench_cli_process();
+  bench_commands();
+  bench_vsnprintf();
+  bench_memory();
+
+  println_("done");
+
+  while (1)
+  {
+  }
+}
+
+int32_t putchar_(char c)
+{
+  if(!muted){
+    // loop while the LPUART_TDR register is full
+    while(LL_LPUART_IsActiveFlag_TXE_TXFNF(LPUART1) != 1);
+    // once the LPUART_TDR register is empty, fill it with char c
+    LL_LPUART_TransmitData8(LPUART1, (uint8_t)c);
+  }
+  return (c);
+}
+
+int32_t write_(const char *buf, uint32_t len)
+{
+  for(uint32_t i = 0; i < len; i++){
+    putchar_(buf[i]);
+  }
+  return (len);
+}
+
+// time how long cli_process() takes per character for the common editing cases
+static void bench_cli_process(void)
+{
+  // the typed lines are cut from these characters, so they fit in rxBuffer and cmdBuffer (see BENCH_LINE_LEN)
+  static const char chars[BENCH_LINE_MAX + 1] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789ab";
+  static char line[BENCH_LINE_LEN + 1];
+  const uint32_t line_len = BENCH_LINE_LEN;
+  // inserted into the middle of line
+  static char half_line[BENCH_HALF_LEN + 1];
+  const uint32_t half_line_len = BENCH_HALF_LEN;
+  // each cursor move is a 3 character escape sequence
+  const uint32_t cursor_moves = BENCH_HALF_LEN / 2;
+  uint32_t cycles;
+
+  memcpy_(line, chars, line_len);
+  line[line_len] = '\0';
+  memcpy_(half_line, chars, half_line_len);
+  half_line[half_line_len] = '\0';
+
+  print_newline();
+  printfln_("%-36s%12s", "cli_process", "cycles/char");
+
+  // typing at the end of the line
+  TIME_CYCLES(cycles, {
+    reset_cmdBuffer(&defaultCtx);
+    muted = true;
+    feed_cli(line);
+    start_ = DWT->CYCCNT;
+    cli_process();
+    muted = false;
+  });
+  printfln_("%-36s%12u", "  append printable", cycles / line_len);
+
+  // typing in the middle of the line
+  TIME_CYCLES(cycles, {
+    reset_cmdBuffer(&defaultCtx);
+    muted = true;
+    feed_cli(line);
+    cli_process();
+    defaultCtx.cmdBuffer.cursorOffset = defaultCtx.cmdBuffer.len / 2;
+    feed_cli(half_line);
+    start_ = DWT->CYCCNT;
+    cli_process();
+    muted = false;
+  });
+  printfln_("%-36s%12u", "  insert printable mid-line", cycles / half_line_len);
+
+  // moving the cursor with escape sequences (3 characters each)
+  TIME_CYCLES(cycles, {
+    reset_cmdBuffer(&defaultCtx);
+    muted = true;
+    feed_cli(line);
+    cli_process();
+    for(uint32_t i = 0; i < cursor_moves; i++){
+      feed_cli("\x1B[D");
+    }
+    start_ = DWT->CYCCNT;
+    cli_process();
+    muted = false;
+  });
+  printfln_("%-36s%12u", "  cursor left escape sequence", cycles / (cursor_moves * 3));
+
+  // deleting characters
+  TIME_CYCLES(cycles, {
+    reset_cmdBuffer(&defaultCtx);
+    muted = true;
+    feed_cli(line);
+    cli_process();
+    for(uint32_t i = 0; i < half_line_len; i++){
+      feed_cli("\b");
+    }
+    start_ = DWT->CYCCNT;
+    cli_process();
+    muted = false;
+  });
+  printfln_("%-36s%12u", "  backspace", cycles / half_line_len);
+
+  reset_cmdBuffer(&defaultCtx);
+}
+
+// time command lookup and tokenizing
+static void bench_commands(void)
+{
+  // terminate_tokens modifies its input, so it gets a fresh copy every run
+  static const char args_line[] = "cmd arg1 arg2 arg3 arg4 arg5 arg6 arg7";
+  static const char long_line[] = "flash_write 0x0803E000 0123456789abcdef0123456789abcdef0123456789abcdef";
+  // the copies are word-aligned, the same as the command buffer usually is
+  char tokens[sizeof(long_line)] __attribute__((aligned(4)));
+  uint32_t argc;
+  char *argv[MAX_NUM_ARGS + 1];
+  tokenEnd ends[MAX_NUM_ARGS + 1];
+  const cmdEntry *volatile found;
+  uint32_t cycles;
+  uint32_t copy_cycles;
+
+  print_newline();
+  printfln_("%-36s%12s", "command lookup", "cycles");
+  printfln_("%-36s%12u", "  registered commands", (uint32_t)(__mcli_cmd_end - __mcli_cmd_start));
+
+  TIME_CYCLES(cycles, found = find_command("help"));
+  printfln_("%-36s%12u", "  find_command hit", cycles);
+  TIME_CYCLES(cycles, found = find_command("zzzzzzzz"));
+  printfln_("%-36s%12u", "  find_command miss", cycles);
+  (void)found;
+
+  TIME_CYCLES(copy_cycles, memcpy_(tokens, args_line, sizeof(args_line)));
+  TIME_CYCLES(cycles, {
+    memcpy_(tokens, args_line, sizeof(args_line));
+    tokenize_command(tokens, sizeof(args_line) - 1, &argc, argv, ends);
+    terminate_tokens(argc, argv, ends);
+  });
+  printfln_("%-36s%12u", "  tokenize_command 8 words", (cycles > copy_cycles) ? (cycles - copy_cycles) : 0);
+
+  TIME_CYCLES(copy_cycles, memcpy_(tokens, long_line, sizeof(long_line)));
+  TIME_CYCLES(cycles, {
+    memcpy_(tokens, long_line, sizeof(long_line));
+    tokenize_command(tokens, sizeof(long_line) - 1, &argc, argv, ends);
+    terminate_tokens(argc, argv, ends);
+  });
+  printfln_("%-36s%12u", "  tokenize_command 71 chars", (cycles > copy_cycles) ? (cycles - copy_cycles) : 0);
+}
+
+// time vsnprintf_ for every conversion type
+static void bench_vsnprintf(void)
+{
+  char out[64];
+  uint32_t cycles;
+
+  print_newline();
+  printfln_("%-36s%12s", "snprintf_", "cycles");
+
+#define BENCH_FORMAT(label, ...) do { \
+    TIME_CYCLES(cycles, snprintf_(out, sizeof(out), __VA_ARGS__)); \
+    printfln_("%-36s%12u", "  " label, cycles); \
+  } while(0)
+
+  BENCH_FORMAT("literal (16 chars)", "0123456789abcdef");
+  BENCH_FORMAT("%c", "%c", 'x');
+  BENCH_FORMAT("%s (16 chars)", "%s", "0123456789abcdef");
+  BENCH_FORMAT("%-20s", "%-20s", "help");
+  BENCH_FORMAT("%d small", "%d", 7);
+  BENCH_FORMAT("%d large negative", "%d", -2000000000);
+  BENCH_FORMAT("%u max", "%u", UINT32_MAX);
+  BENCH_FORMAT("%08X", "%08X", 0xBEEFu);
+  BENCH_FORMAT("%x max", "%x", UINT32_MAX);
+  BENCH_FORMAT("%llu max", "%llu", UINT64_MAX);
+  BENCH_FORMAT("%llx max", "%llx", UINT64_MAX);
+  BENCH_FORMAT("%#b max", "%#b", UINT32_MAX);
+  BENCH_FORMAT("%p", "%p", (void *)src_block);
+#if PRINTF_FLOAT
+  BENCH_FORMAT("%f", "%f", 3.14159265);
+  BENCH_FORMAT("%.2f negative", "%.2f", -1234.5678);
+  BENCH_FORMAT("%.3q (Q16.16)", "%.3q", 16, 0x0003243F);
+#endif
+  BENCH_FORMAT("telemetry line", "t=%u v=%d i=%d s=%s", 123456u, -3300, 42, "ok");
+
+#undef BENCH_FORMAT
+
+  // the same line from a compiled format. The first run compiles it, but only the fastest run is kept
+  PRINTF_FORMAT(telemetry, "t=%u v=%d i=%d s=%s");
+  TIME_CYCLES(cycles, snprintf_compiled_(out, sizeof(out), &telemetry, 123456u, -3300, 42, "ok"));
+  printfln_("%-36s%12u", "  telemetry line (compiled)", cycles);
+}
+
+// time the assembly memory functions across sizes and alignments
+static void bench_memory(void)
+{
+  static const uint32_t sizes[] = {1, 4, 16, 64, BENCH_MAX_BYTES};
+  // each pair is {destination offset, source offset} from a 4-byte boundary
+  static const uint8_t offsets[][2] = {{0, 0}, {1, 1}, {0, 1}, {2, 3}};
+  uint32_t cycles;
+
+  for(uint32_t i = 0; i < sizeof(src_block); i++){
+    src_block[i] = (uint8_t)('a' + (i % 26));
+  }
+
+  print_newline();
+  printfln_("%-36s%12s", "memory functions (dst+src offset)", "cycles");
+
+  for(uint32_t s = 0; s < COUNT_OF(sizes); s++){
+    for(uint32_t o = 0; o < COUNT_OF(offsets); o++){
+      uint8_t *dest = &dest_block[offsets[o][0]];
+      const uint8_t *src = &src_block[offsets[o][1]];
+      const uint32_t n = sizes[s];
+
+      TIME_CYCLES(cycles, memcpy_(dest, src, n));
+      printfln_("  memcpy_  %3u bytes +%u+%u%*s%12u", n, offsets[o][0], offsets[o][1], 13, "", cycles);
+      TIME_CYCLES(cycles, memmove_(dest, src, n));
+      printfln_("  memmove_ %3u bytes +%u+%u%*s%12u", n, offsets[o][0], offsets[o][1], 13, "", cycles);
+      // overlapping block 1 byte after the source, so memmove_ has to copy backwards
+      TIME_CYCLES(cycles, memmove_(&src_block[offsets[o][1] + 1], src, n));
+      printfln_("  memmove_ %3u bytes back +%u+%u%*s%12u", n, offsets[o][1] + 1, offsets[o][1], 8, "", cycles);
+
+      // strcmp_ compares two equal strings, so it has to read all n bytes
+      memcpy_(dest, src, n);
+      dest[n - 1] = '\0';
+      src_block[offsets[o][1] + n - 1] = '\0';
+      TIME_CYCLES(cycles, strcmp_((const char *)dest, (const char *)src));
+      printfln_("  strcmp_  %3u bytes +%u+%u%*s%12u", n, offsets[o][0], offsets[o][1], 13, "", cycles);
+      TIME_CYCLES(cycles, strlen_((const char *)src));
+      printfln_("  strlen_  %3u bytes +%u+%u%*s%12u", n, offsets[o][0], offsets[o][1], 13, "", cycles);
+      src_block[offsets[o][1] + n - 1] = (uint8_t)('a' + ((offsets[o][1] + n - 1) % 26));
+
+      TIME_CYCLES(cycles, memset_(dest, ' ', n));
+      printfln_("  memset_  %3u bytes +%u%*s%12u", n, offsets[o][0], 15, "", cycles);
+    }
+  }
+}
+
+// push a string into the cli without processing it
+static void feed_cli(const char *str)
+{
+  cli_input_block(str, strlen_(str));
+}
+
+static void cycle_counter_init(void)
+{
+  // the DWT cycle counter is part of the debug unit, which has to be enabled first
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+  // measure how long an empty measurement takes
+  timer_overhead = 0;
+  uint32_t cycles;
+  TIME_CYCLES(cycles, {});
+  timer_overhead = cycles;
+}
+
+static void sysclk_init(void)
+{
+  // update the global variable SystemCoreClock
+  SystemCoreClockUpdate();
+
+  // configure 1ms systick for easy delays
+  LL_RCC_ClocksTypeDef clk_struct;
+  LL_RCC_GetSystemClocksFreq(&clk_struct);
+  LL_Init1msTick(clk_struct.HCLK1_Frequency);
+}
+
+// same LPUART setup as src/main.c, but polled so no interrupts fire during a measurement
+static void UART_init(void)
+{
+  // enable the UART GPIO port clock
+  LL_AHB2_GRP1_EnableClock(LL_AHB2_GRP1_PERIPH_GPIOA);
+
+  // set the LPUART clock source to the peripheral clock
+  LL_RCC_SetLPUARTClockSource(LL_RCC_LPUART1_CLKSOURCE_PCLK1);
+
+  // enable clock for LPUART
+  LL_APB1_GRP2_EnableClock(LL_APB1_GRP2_PERIPH_LPUART1);
+
+  // configure GPIO pins for LPUART1 communication
+  // TX Pin is PA2, RX Pin is PA3
+  LL_GPIO_InitTypeDef GPIO_InitStruct = {
+  .Pin = LL_GPIO_PIN_2 | LL_GPIO_PIN_3,
+  .Mode = LL_GPIO_MODE_ALTERNATE,
+  .Pull = LL_GPIO_PULL_NO,
+  .Speed = LL_GPIO_SPEED_FREQ_MEDIUM,
+  .OutputType = LL_GPIO_OUTPUT_PUSHPULL,
+  .Alternate = LL_GPIO_AF_8
+};
+  LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+  // baud = 115200, data bits = 8, stop bits = 1, parity bits = 0
+  LL_LPUART_InitTypeDef LPUART_InitStruct = {
+      .PrescalerValue = LL_LPUART_PRESCALER_DIV1,
+      .BaudRate = 115200,
+      .DataWidth = LL_LPUART_DATAWIDTH_8B,
+      .StopBits = LL_LPUART_STOPBITS_1,
+      .Parity = LL_LPUART_PARITY_NONE,
+      .TransferDirection = LL_LPUART_DIRECTION_TX_RX,
+      .HardwareFlowControl = LL_LPUART_HWCONTROL_NONE
+  };
+  LL_LPUART_Init(LPUART1, &LPUART_InitStruct);
+  LL_LPUART_Enable(LPUART1);
+
+  // wait for the LPUART module to send an idle frame and finish initialization
+  while(!(LL_LPUART_IsActiveFlag_TEACK(LPUART1)) || !(LL_LPUART_IsActiveFlag_REACK(LPUART1)));
+}
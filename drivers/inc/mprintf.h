@@ -4,9 +4,45 @@
 #define __MPRINTF_H
 
 
+#include "mcli_config.h"
+
 #include <stdarg.h>
 #include <stdint.h>
 
+// a print_sink receives formatted text from vcbprintf_ in chunks as it is produced
+// ctx is whatever was passed to vcbprintf_, and buf holds len characters (not '\0' terminated)
+typedef int32_t (*print_sink)(void *ctx, const char *buf, uint32_t len);
+
+// a compiled format is a format string that is parsed once, into a list of ops, the first time it is printed.
+// each op is a span of the format string to copy followed by one conversion, so printing it again
+// only has to walk the ops and the arguments. declare one with PRINTF_FORMAT(), for example:
+//   PRINTF_FORMAT(telemetry, "t=%u v=%d i=%d");
+//   printfln_compiled_(&telemetry, ticks, millivolts, milliamps);
+// the format string must stay in place (a literal is best), and must not be more than 64 KiB long.
+// field widths and precisions written in the format string are limited to 65535
+// the fields of printf_op are only used by mprintf.c
+typedef struct {
+    uint16_t literal_start;     // where the text before the conversion starts in the format string
+    uint16_t literal_len;       // how many characters of text there are before the conversion
+    uint16_t min_width;         // the field width, unless it comes from an argument ('*')
+    uint16_t precision;         // the precision, unless it comes from an argument ('*')
+    uint16_t flags;             // which flags the conversion has
+    char conversion;            // the conversion character, or '\0' if there is only text
+} printf_op;
+
+typedef struct {
+    const char *format_str;
+#if PRINTF_COMPILED
+    uint8_t num_ops;            // 0 until the format is compiled, or 255 if it needs too many ops
+    printf_op ops[PRINTF_COMPILED_OPS];
+#endif
+} printf_format;
+
+// declares a compiled format called name, for the format string str
+// it is static, so it can be declared inside the function that prints it
+#define PRINTF_FORMAT(name, str)    static printf_format name = { .format_str = (str) }
+
+int32_t write_(const char * buf, uint32_t len);
 int32_t puts_(const char * restrict str);
 int32_t println_(const char * restrict str);
 int32_t printfln_(const char * restrict format_str, ...);
@@ -14,8 +50,21 @@ int32_t printf_(const char * restrict format_str, ...);
 int32_t sprintf_(char * restrict out_str, const char * restrict format_str, ...);
 int32_t snprintf_(char * restrict out_str, uint32_t buf_len, const char * restrict format_str, ...);
 int32_t vsnprintf_(char * restrict out_str, uint32_t buf_len, const char * restrict format_str, va_list arg);
+int32_t vcbprintf_(print_sink sink, void *sink_ctx, const char * restrict format_str, va_list arg);
+int32_t cbprintf_args_(print_sink sink, void *sink_ctx, const char * restrict format_str,
+                       const uintptr_t *args, uint32_t num_args);
+// these print a compiled format, the same way as their regular counterparts
+int32_t printf_compiled_(printf_format *format, ...);
+int32_t printfln_compiled_(printf_format *format, ...);
+int32_t snprintf_compiled_(char * restrict out_str, uint32_t buf_len, printf_format *format, ...);
+int32_t vcbprintf_compiled_(print_sink sink, void *sink_ctx, printf_format *format, va_list arg);
+// parses format now instead of the first time it is printed
+// returns the number of ops, or -1 if it needs more than PRINTF_COMPILED_OPS (it is then parsed every time)
+int32_t printf_compile_(printf_format *format);
 char * strncpy_(char * restrict dest_str, const char * restrict src_str, uint32_t len);
+// strlen_ is written in assembly (mstrlen.s)
 uint32_t strlen_(const char * restrict str);
 int32_t print_newline(void);
+uint32_t printf_truncations_(void);
 
 #endif // __MPRINTF_H
\ No newline at end of file
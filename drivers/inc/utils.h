@@ -17,5 +17,6 @@
 int32_t strcmp_(const char *str1, const char *str2);
 void* memmove_(void *destination, const void *source, uint32_t num);
 void* memcpy_(void *destination, const void *source, uint32_t num);
+void* memset_(void *destination, uint8_t value, uint32_t num);
 
 #endif /* __UTILS_H */
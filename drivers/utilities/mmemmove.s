@@ -17,7 +17,7 @@ memmove_:
 @ r2 = num bytes
 @ returns destination addr in r0
   cmp   r2, #0              @ if there are 0 bytes to move
-  push  {r4, r5, r6}        @ store r4, r5, & r6 values on stack
+  push  {r4, r5, r6, r7}    @ store r4, r5, r6 & r7 values on stack
   beq   exit                @ exit
 
   movs  r6, #3              @ put a 3 in r6. This is used later to test for 4-byte alignment.
@@ -44,17 +44,10 @@ memmove_:
 
 .balign 4                   @ align the loop to a 4 byte boundary
 @ if there are 16 or more bytes to copy and the src and dest are 4-byte aligned, can copy word-wise
+@ r6 isn't needed for the alignment test anymore, so it can hold one of the 4 words
 quad_word_b_copy:
-  subs    r3, r3, #16       @ decrement r3 and r4 by 16
-  subs    r4, r4, #16
-  ldr     r5, [r3, #12]     @ load word from memory[r3+12] into r5
-  str     r5, [r4, #12]     @ store r5 word into memory[r4+12]
-  ldr     r5, [r3, #8]
-  str     r5, [r4, #8]
-  ldr     r5, [r3, #4]
-  str     r5, [r4, #4]
-  ldr     r5, [r3]
-  str     r5, [r4]
+  ldmdb   r3!, {r5-r7, r12} @ decrement r3 by 16, then load r5-r7 & r12 with words from memory[r3]
+  stmdb   r4!, {r5-r7, r12} @ decrement r4 by 16, then store r5-r7 & r12 values into memory[r4]
   subs    r2, r2, #16       @ decrement remaining bytes by 16
   cmp     r2, #16
   bhs   quad_word_b_copy    @ if there are 16+ bytes left, quad word copy again
@@ -109,16 +102,8 @@ copy_f:                     @ copy from beginning of source and work forwards
 .balign 4                   @ align the loop to an 4 byte boundary
 @ if there are 16 or more bytes to copy and the src and dest are 4-byte aligned, can copy word-wise
 quad_word_f_copy:
-  ldr   r5, [r1]            @ load word from memory[r1] into r5
-  str   r5, [r4]            @ store r5 word into memory[r4]
-  ldr   r5, [r1, #4]
-  str   r5, [r4, #4]
-  ldr   r5, [r1, #8]
-  str   r5, [r4, #8]
-  ldr   r5, [r1, #12]
-  str   r5, [r4, #12]
-  adds  r1, #16             @ increment r1 and r4 by 16
-  adds  r4, #16
+  ldm   r1!, {r5-r7, r12}   @ load r5-r7 & r12 with words from memory[r1], then increment r1 by 16
+  stm   r4!, {r5-r7, r12}   @ store r5-r7 & r12 values into memory[r4], then increment r4 by 16
   subs  r2, r2, #16         @ decrement remaining bytes by 16
   cmp   r2, #16
   bhs   quad_word_f_copy    @ if there are 16+ bytes left, quad word copy again
@@ -160,7 +145,7 @@ copy_fwd_single:
   bne   copy_fwd_single     @ if not done, repeat
 
 exit:
-  pop   {r4, r5, r6}        @ restore previous value of r4 & r5
+  pop   {r4, r5, r6, r7}    @ restore previous value of r4, r5, r6 & r7
   bx    lr                  @ exit function
 
   .size memmove_, . - memmove_
@@ -0,0 +1,78 @@
+  @ tells the assembler to use the unified instruction set
+  .syntax unified
+  @ this directive selects the thumb (16-bit) instruction set
+  .thumb
+  @ this directive specifies the following symbol is a thumb-encoded function
+  .thumb_func
+  @ align the next variable or instruction on a 2-byte boundary
+  .balign 2
+  @ make the symbol visible to the linker
+  .global memset_
+  @ marks the symbol as being a function name
+  .type memset_, STT_FUNC
+memset_:
+@ r0 = destination addr
+@ r1 = byte value
+@ r2 = num bytes
+@ returns destination addr in r0
+
+  cmp   r2, #0              @ if there are 0 bytes to set
+  beq   no_pop_exit         @ exit
+
+  mov   r3, r0              @ copy destination addr into r3
+  and   r1, r1, #0xFF       @ only the low byte of r1 is used
+  orr   r1, r1, r1, lsl #8  @ copy the byte into all 4 bytes of r1, so a word can be stored at once
+  orr   r1, r1, r1, lsl #16
+  cmp   r2, #4              @ check if there are 4+ bytes to set
+  blo   set_single          @ if not, set one at a time
+
+@ set the first few bytes individually until the destination is aligned
+@ there are 4+ bytes, so at least 1 is left once it is aligned
+align_chunk:
+  tst   r3, #3              @ check if the destination address is 4-byte aligned
+  beq   aligned             @ if so, the bytes can be set a word at a time
+  strb  r1, [r3], #1        @ store r1 byte into memory[r3], then increment r3 by 1
+  subs  r2, r2, #1          @ decrement remaining bytes by 1
+  b     align_chunk
+
+aligned:
+  cmp   r2, #16             @ check if there are 16+ bytes to set
+  blo   word_set            @ if not, set 4 bytes at a time
+
+@ there are 16 or more bytes to set and the destination is 4-byte aligned, so set 4 words at a time
+  push  {r4, r5}            @ store r4 & r5 values on stack
+  mov   r4, r1              @ copy the value into r4, r5 & r12, so stm can store 4 words at once
+  mov   r5, r1
+  mov   r12, r1
+.balign 4                   @ align the loop to a 4 byte boundary
+quad_word_set:
+  stm   r3!, {r1, r4, r5, r12}  @ store r1, r4, r5 & r12 into memory[r3], then increment r3 by 16
+  subs  r2, r2, #16         @ decrement remaining bytes by 16
+  cmp   r2, #16
+  bhs   quad_word_set       @ if there are 16+ bytes left, quad word set again
+  pop   {r4, r5}            @ if not, restore r4 & r5, we are done using them
+
+word_set:
+  cmp   r2, #4              @ check if there are 4+ bytes to set
+  blo   set_tail            @ if not, finish with single bytes
+word_loop:
+  str   r1, [r3], #4        @ store r1 word into memory[r3], then increment r3 by 4
+  subs  r2, r2, #4          @ decrement remaining bytes by 4
+  cmp   r2, #4
+  bhs   word_loop           @ if there are 4+ bytes left, set another word
+
+set_tail:
+  cmp   r2, #0              @ check if there are 0 bytes left to set
+  beq   no_pop_exit         @ if so, exit
+@ otherwise, there are <4 bytes left to set
+
+set_single:
+  strb  r1, [r3], #1        @ store r1 byte into memory[r3], then increment r3 by 1
+  subs  r2, r2, #1          @ decrement remaining bytes by 1
+  bne   set_single          @ if bytes are left, repeat
+
+no_pop_exit:
+  bx    lr                  @ exit function
+
+  .size memset_, . - memset_
+
@@ -1,17 +1,62 @@
 #include "mprintf.h"
+#include "mcli_config.h"
+#include "utils.h"
 
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-// printf_ buffer size. This defines the longest string printf_ can print.
-// make it larger to print longer strings, or smaller to decrease RAM usage.
-#define PRINTF_BUFFER_SIZE   512
-
-// maximum length of a single number including sign and padding
-// size of 34 should be enough to hold any 32 bit number converted to 
-// binary (widest format) plus a prefix of "0b"
-#define NUM_MAX_WIDTH    34
+// PRINTF_STAGING_SIZE and the format switches are set in mcli_config.h
+
+// maximum number of digits in a single number
+// size of 64 is enough to hold any 64 bit number converted to 
+// binary (widest format). The sign, prefix and padding are printed separately.
+// without binary, the widest is a 20 digit decimal number
+#if PRINTF_BINARY
+#define NUM_MAX_WIDTH    64
+#else
+#define NUM_MAX_WIDTH    20
+#endif
+
+#if PRINTF_FLOAT
+// number of digits printed after the '.' by %f and %q when no precision is given
+#define FIXED_DEFAULT_PRECISION  6
+// the most digits %f and %q print after the '.'. A larger precision is cut down to this
+// every digit is exact for numbers of at least 2^-11. Below that, the fraction only keeps 64 bits,
+// so the last digit can be off by 1 when there are more than about 19 digits after the '.'
+#define FIXED_MAX_PRECISION      16
+#endif
+
+// strncpy_ scans the source a word (4 bytes) at a time once it is aligned, like strlen_ in mstrlen.s
+// WORD_HAS_ZERO() is nonzero if any of the 4 bytes of word is 0
+#define WORD_ONES           0x01010101UL
+#define WORD_HIGHS          0x80808080UL
+#define WORD_HAS_ZERO(word) (((word) - WORD_ONES) & ~(word) & WORD_HIGHS)
+// the source is a char array, so words are read through a type that may alias it
+typedef uint32_t __attribute__((may_alias)) aliasWord;
+
+// the next argument, from a va_list or from an array of words (see struct print_args)
+#define NEXT_ARG(args, type) \
+    (((args)->list != NULL) ? va_arg(*(args)->list, type) : (type)next_word(args))
+// integer arguments are 32 bits unless a length modifier says they are 64
+#define UNSIGNED_ARG(args, flags) \
+    (((flags).long_long == true) ? NEXT_ARG(args, uint64_t) : (uint64_t)NEXT_ARG(args, uint32_t))
+
+// bits of printf_op.flags
+#define OP_FILL_ZERO        (1 << 0)    // '0' flag
+#define OP_LEFT_ALIGN       (1 << 1)    // '-' flag
+#define OP_POSITIVE_SPACE   (1 << 2)    // ' ' flag
+#define OP_DISPLAY_SIGN     (1 << 3)    // '+' flag
+#define OP_DISPLAY_PREFIX   (1 << 4)    // '#' flag
+#define OP_LONG_LONG        (1 << 5)    // the argument is 64 bits
+#define OP_HAS_PRECISION    (1 << 6)    // a precision was given
+#define OP_WIDTH_ARG        (1 << 7)    // the field width is the next argument
+#define OP_PRECISION_ARG    (1 << 8)    // the precision is the next argument
+
+#if PRINTF_COMPILED
+// printf_format.num_ops for a format string that needs more than PRINTF_COMPILED_OPS
+#define FORMAT_TOO_LONG     UINT8_MAX
+#endif
 
 struct format_flags {
     bool fill_zero;         // if there's padding, should it be zero? otherwise pad with space
@@ -22,33 +67,119 @@ struct format_flags {
     bool is_negative;       // tells us to display a negative sign
     bool display_prefix;    // tells us to display a prefix before the base 2 or base 16 number ("0x" or "0b")
     bool capitalize;        // tells us to use captial letters for hexadecimal
+    bool long_long;         // the argument is 64 bits ("ll", or "l" where long is 64 bits)
     uint32_t min_width;     // stores the minimum field width
+    bool has_precision;     // was a precision ('.' followed by a number or '*') given?
+    uint32_t precision;     // stores the precision, if there is one
  
     uint32_t base;
 };
 
+// print_stream is where formatted text is written.
+// characters are collected in buf. If there is a sink, a full buf is handed to the sink
+// and then reused. If there is no sink, anything that doesn't fit in buf is dropped.
+struct print_stream {
+    char *buf;              // the buffer characters are collected in
+    uint32_t buf_len;       // how many characters buf can hold
+    uint32_t write_index;   // how many characters are currently in buf
+    print_sink sink;        // where a full buf is sent, or NULL to truncate instead
+    void *sink_ctx;         // passed to sink every time it is called
+    int32_t total_len;      // how many characters have been formatted, including any dropped ones
+};
+
+// print_args is where the arguments of a conversion come from
+// either list points to a va_list, or it is NULL and they are taken from words (for cbprintf_args_())
+struct print_args {
+    va_list *list;
+    const uintptr_t *words;
+    uint32_t num_words;     // how many words are left
+};
+
 // maps all hex numbers to their index
 static const char lc_map[] = "0123456789abcdef";
 static const char uc_map[] = "0123456789ABCDEF";
+// maps every number from 0 to 99 to its 2 decimal digits
+// the digits for n are found at decimal_pairs[2n] and decimal_pairs[2n+1]
+static const char decimal_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+// powers_of_10[n] is the smallest number with n+1 decimal digits
+static const uint32_t powers_of_10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
 
-extern int32_t putchar_(char c);
+// how many times output was cut short: by a vsnprintf_() buffer that was too small,
+// or by a sink (like write_()) that didn't take everything it was given
+static uint32_t truncation_count = 0;
 
-static int32_t insert_string(char * restrict out_str, uint32_t out_str_len, 
-                    const char * restrict in_str, struct format_flags flags);
-static int32_t convert_number(char * restrict out_str, uint32_t out_str_len,
-                        uint32_t value, struct format_flags flags);
-static int32_t reverse_string(char * restrict out_str, uint32_t out_str_len, 
-                    const char * restrict in_str, uint32_t in_str_len, 
+extern int32_t putchar_(char c);
+int32_t write_(const char * buf, uint32_t len) __attribute__((weak));
+
+static void format_stream(struct print_stream *stream, const char * restrict format_str, va_list arg);
+static void format_args(struct print_stream *stream, const char * restrict format_str, struct print_args *args);
+static void format_compiled_stream(struct print_stream *stream, printf_format *format, va_list arg);
+static uint32_t parse_spec(const char * restrict format_str, uint32_t read_index, printf_op *op);
+static uint16_t parse_digits(const char * restrict format_str, uint32_t *read_index);
+static void convert_op(struct print_stream *stream, const printf_op *op, struct print_args *args);
+static inline uintptr_t next_word(struct print_args *args);
+static void insert_string(struct print_stream *stream, const char * restrict in_str,
+                    struct format_flags flags);
+static void convert_number(struct print_stream *stream, uint64_t value,
+                    struct format_flags flags);
+static uint32_t format_sign(char *head, struct format_flags flags);
+static uint32_t format_decimal(char *num_buffer, uint32_t value);
+static uint32_t format_decimal64(char *num_buffer, uint64_t value);
+static uint32_t format_bits(char *num_buffer, uint64_t value, uint32_t bits_per_digit, const char *map);
+static void print_padded(struct print_stream *stream, const char *head, uint32_t head_len,
+                    const char *body, uint32_t body_len, const char *tail, uint32_t tail_len,
                     struct format_flags flags);
+static uint32_t count_decimal_digits(uint32_t value);
+#if PRINTF_FLOAT
+static void convert_double(struct print_stream *stream, double value, struct format_flags flags);
+static void convert_q(struct print_stream *stream, int32_t value, uint32_t frac_bits,
+                    struct format_flags flags);
+static void convert_fixed(struct print_stream *stream, uint64_t int_part, uint64_t frac,
+                    struct format_flags flags);
+static inline uint32_t next_fraction_digit(uint64_t *frac);
+#endif
+
+static void stream_write(struct print_stream *stream, const char * restrict str, uint32_t len);
+static void stream_fill(struct print_stream *stream, char c, uint32_t count);
+static void stream_flush(struct print_stream *stream);
+static void stream_sink(struct print_stream *stream, const char *buf, uint32_t len);
+static int32_t write_sink(void *ctx, const char *buf, uint32_t len);
+
+
+// outputs len characters from buf
+// all printing functions send their output through write_(), so it can be
+// replaced by a function that moves the whole span at once (DMA, USB CDC, RTT, etc.)
+// this default version is used when no other write_() is defined, and falls
+// back to calling putchar_() once per character
+// returns the number of characters written
+int32_t write_(const char * buf, uint32_t len)
+{
+    for(uint32_t i = 0; i < len; i++){
+        putchar_(buf[i]);
+    }
+    return(len);
+}
 
+// returns how many times printed output has been cut short, either because a
+// vsnprintf_() buffer was too small or because write_() (or another sink) didn't take all of it
+uint32_t printf_truncations_(void)
+{
+    return(truncation_count);
+}
 
 // prints a newline
 // returns the number of characters printed
 int32_t print_newline(void)
 {
     // adjust line-ending as you see fit 
-    putchar_('\r');
-    putchar_('\n');
+    write_("\r\n", 2);
     return(2);  // return the number of characters printed
 }
 
@@ -56,59 +187,41 @@ int32_t print_newline(void)
 // returns the number of characters printed
 int32_t puts_(const char * restrict str)
 {
-    int32_t i = 0;
+    int32_t len = strlen_(str);
 
-    // increment until we hit the string terminating character
-    while(str[i] != '\0'){
-        putchar_(str[i++]);
-    }
+    write_(str, len);
 
-    return(i);
+    return(len);
 }
 
 // prints a string to output, then prints a newline character
 // returns the number of characters printed
 int32_t println_(const char * restrict str)
 {
-    int32_t i = 0;
+    int32_t len = strlen_(str);
 
-    // increment until we hit the string terminating character
-    while(str[i] != '\0'){
-        putchar_(str[i++]);
-    }
+    write_(str, len);
 
     // print a new line and add the character count
-    i += print_newline(); 
+    len += print_newline(); 
 
-    return(i);
+    return(len);
 }
 
 // prints a formatted string to the output, then prints a newline character
-// returns the number of characters successfully printed
+// returns the number of characters printed
 int32_t printfln_(const char * restrict format_str, ...)
 {
-    char output_buffer[PRINTF_BUFFER_SIZE];
     va_list arg;
-    int32_t ret;
     int32_t print_len;
 
     // start reading the list of variable length arguments
     va_start(arg, format_str);
 
-    ret = vsnprintf_(output_buffer, PRINTF_BUFFER_SIZE, format_str, arg);
+    print_len = vcbprintf_(write_sink, NULL, format_str, arg);
 
     va_end(arg);
 
-    if(ret > (PRINTF_BUFFER_SIZE - 1)){
-        print_len = (PRINTF_BUFFER_SIZE - 1);
-    }else{
-        print_len = ret;
-    }
-
-    for(int32_t i = 0; i < print_len; i++){
-        putchar_(output_buffer[i]);
-    }
-
     // print a new line and add the character count
     print_len += print_newline();
 
@@ -116,31 +229,19 @@ int32_t printfln_(const char * restrict format_str, ...)
 }
 
 // prints a formatted string to the output
-// returns the number of characters successfully printed
+// returns the number of characters printed
 int32_t printf_(const char * restrict format_str, ...)
 {
-    char output_buffer[PRINTF_BUFFER_SIZE];
     va_list arg;
-    int32_t ret;
     int32_t print_len;
 
     // start reading the list of variable length arguments
     va_start(arg, format_str);
 
-    ret = vsnprintf_(output_buffer, PRINTF_BUFFER_SIZE, format_str, arg);
+    print_len = vcbprintf_(write_sink, NULL, format_str, arg);
 
     va_end(arg);
 
-    if(ret > (PRINTF_BUFFER_SIZE - 1)){
-        print_len = (PRINTF_BUFFER_SIZE - 1);
-    }else{
-        print_len = ret;
-    }
-
-    for(int32_t i = 0; i < print_len; i++){
-        putchar_(output_buffer[i]);
-    }
-
     return(print_len);
 }
 
@@ -180,19 +281,258 @@ int32_t snprintf_(char * restrict out_str, uint32_t buf_len, const char * restri
 // returns the theoretical number of characters written to buffer, assuming infininte buffer space
 int32_t vsnprintf_(char * restrict out_str, uint32_t buf_len, const char * restrict format_str, va_list arg)
 {
-    uint32_t read_index = 0;
-    uint32_t write_index = 0;
-    //length of output string if we run into no buffer limits
-    int32_t max_str_len = 0;
+    if(buf_len == 0){
+        return 0;
+    }
+
+    // assuming buf_len isn't 0, 1 byte is always left for the '\0'
+    // there is no sink, so anything that doesn't fit is dropped
+    struct print_stream stream = {
+        .buf = out_str,
+        .buf_len = buf_len - 1,
+        .write_index = 0,
+        .sink = NULL,
+        .sink_ctx = NULL,
+        .total_len = 0
+    };
+
+    format_stream(&stream, format_str, arg);
+
+    if((uint32_t)stream.total_len > stream.buf_len){
+        truncation_count++;
+    }
+    // terminate the string
+    out_str[stream.write_index] = '\0';
+    // return the max potential length
+    return stream.total_len;
+}
+
+// this function assumes format_str ends with '\0'
+// instead of writing into one big buffer, the formatted text is handed to sink in chunks
+// as it is produced. sink_ctx is passed along to every sink call.
+// only a PRINTF_STAGING_SIZE buffer is used, so there is no limit on the output length
+// returns the number of characters handed to sink
+int32_t vcbprintf_(print_sink sink, void *sink_ctx, const char * restrict format_str, va_list arg)
+{
+    char staging_buffer[PRINTF_STAGING_SIZE];
+    struct print_stream stream = {
+        .buf = staging_buffer,
+        .buf_len = PRINTF_STAGING_SIZE,
+        .write_index = 0,
+        .sink = sink,
+        .sink_ctx = sink_ctx,
+        .total_len = 0
+    };
+
+    format_stream(&stream, format_str, arg);
+
+    // hand over whatever is still waiting in the staging buffer
+    stream_flush(&stream);
+    return stream.total_len;
+}
+
+// the same as vcbprintf_(), but the arguments are num_args words in args instead of a va_list.
+// this is for printing arguments that were saved to print later (like the mcli log does)
+// each word is one argument: an integer (up to 32 bits) or a pointer. %f and 64-bit integers can't be used,
+// and any conversion past the last word gets 0
+int32_t cbprintf_args_(print_sink sink, void *sink_ctx, const char * restrict format_str,
+                       const uintptr_t *args, uint32_t num_args)
+{
+    char staging_buffer[PRINTF_STAGING_SIZE];
+    struct print_stream stream = {
+        .buf = staging_buffer,
+        .buf_len = PRINTF_STAGING_SIZE,
+        .write_index = 0,
+        .sink = sink,
+        .sink_ctx = sink_ctx,
+        .total_len = 0
+    };
+    struct print_args word_args = {
+        .list = NULL,
+        .words = args,
+        .num_words = num_args
+    };
+
+    format_args(&stream, format_str, &word_args);
+
+    stream_flush(&stream);
+    return stream.total_len;
+}
+
+/***** Compiled Formats *****/
+// prints a compiled format to the output
+// returns the number of characters printed
+int32_t printf_compiled_(printf_format *format, ...)
+{
+    va_list arg;
+    int32_t print_len;
+
+    va_start(arg, format);
+
+    print_len = vcbprintf_compiled_(write_sink, NULL, format, arg);
+
+    va_end(arg);
+
+    return(print_len);
+}
+
+// prints a compiled format to the output, then prints a newline character
+// returns the number of characters printed
+int32_t printfln_compiled_(printf_format *format, ...)
+{
+    va_list arg;
+    int32_t print_len;
+
+    va_start(arg, format);
+
+    print_len = vcbprintf_compiled_(write_sink, NULL, format, arg);
+
+    va_end(arg);
+
+    // print a new line and add the character count
+    print_len += print_newline();
 
+    return(print_len);
+}
+
+// the same as snprintf_(), for a compiled format
+int32_t snprintf_compiled_(char * restrict out_str, uint32_t buf_len, printf_format *format, ...)
+{
     if(buf_len == 0){
         return 0;
     }
 
-    // assuming buf_len isn't 0, the logic gets a bit cleaner
+    struct print_stream stream = {
+        .buf = out_str,
+        .buf_len = buf_len - 1,
+        .write_index = 0,
+        .sink = NULL,
+        .sink_ctx = NULL,
+        .total_len = 0
+    };
+    va_list arg;
+
+    va_start(arg, format);
+
+    format_compiled_stream(&stream, format, arg);
+
+    va_end(arg);
+
+    if((uint32_t)stream.total_len > stream.buf_len){
+        truncation_count++;
+    }
+    out_str[stream.write_index] = '\0';
+    return stream.total_len;
+}
+
+// the same as vcbprintf_(), for a compiled format
+int32_t vcbprintf_compiled_(print_sink sink, void *sink_ctx, printf_format *format, va_list arg)
+{
+    char staging_buffer[PRINTF_STAGING_SIZE];
+    struct print_stream stream = {
+        .buf = staging_buffer,
+        .buf_len = PRINTF_STAGING_SIZE,
+        .write_index = 0,
+        .sink = sink,
+        .sink_ctx = sink_ctx,
+        .total_len = 0
+    };
+
+    format_compiled_stream(&stream, format, arg);
+
+    stream_flush(&stream);
+    return stream.total_len;
+}
+
+// splits format's string into ops: each one is the text up to the next '%', and then the conversion.
+// any text after the last conversion gets an op of its own, with no conversion
+// num_ops is set last, so a print that happens part way through (from an interrupt) just compiles it again
+int32_t printf_compile_(printf_format *format)
+{
+#if PRINTF_COMPILED
+    const char *format_str = format->format_str;
+    uint32_t read_index = 0;
+    uint32_t num_ops = 0;
+
+    while(1){
+        const uint32_t read_start = read_index;
+        while((format_str[read_index] != '%') && (format_str[read_index] != '\0')){
+            read_index++;
+        }
+
+        // the text has to be found with 16 bit offsets
+        if((num_ops == PRINTF_COMPILED_OPS) || (read_index > UINT16_MAX)){
+            format->num_ops = FORMAT_TOO_LONG;
+            return (-1);
+        }
+        printf_op *op = &format->ops[num_ops++];
+        op->literal_start = read_start;
+        op->literal_len = read_index - read_start;
+
+        if(format_str[read_index] == '\0'){
+            // just the text, there's nothing to convert
+            op->flags = 0;
+            op->min_width = 0;
+            op->precision = 0;
+            op->conversion = '\0';
+            break;
+        }
+        read_index = parse_spec(format_str, read_index + 1, op);
+        if(format_str[read_index] == '\0'){
+            break;
+        }
+    }
+
+    format->num_ops = num_ops;
+    return (num_ops);
+#else
+    // without PRINTF_COMPILED, there is nowhere to keep the ops
+    (void)format;
+    return (-1);
+#endif
+}
+
+// prints format to stream, compiling it first if this is the first time it is used
+static void format_compiled_stream(struct print_stream *stream, printf_format *format, va_list arg)
+{
+#if PRINTF_COMPILED
+    if(format->num_ops == 0){
+        printf_compile_(format);
+    }
+    if(format->num_ops != FORMAT_TOO_LONG){
+        va_list list;
+        va_copy(list, arg);
+        struct print_args args = { .list = &list };
+        for(uint32_t i = 0; i < format->num_ops; i++){
+            const printf_op *op = &format->ops[i];
+            stream_write(stream, &format->format_str[op->literal_start], op->literal_len);
+            convert_op(stream, op, &args);
+        }
+        va_end(list);
+        return;
+    }
+#endif
+    format_stream(stream, format->format_str, arg);
+}
+
+// prints format_str to stream, taking the arguments from arg
+static void format_stream(struct print_stream *stream, const char * restrict format_str, va_list arg)
+{
+    // convert_op() takes the arguments one at a time through a pointer, so it needs a va_list of its own
+    va_list list;
+    va_copy(list, arg);
+    struct print_args args = { .list = &list };
 
-    // record how long out_str can be
-    uint32_t out_str_len = buf_len - 1;
+    format_args(stream, format_str, &args);
+
+    va_end(list);
+}
+
+// this function assumes format_str ends with '\0'
+// this is where the format string is actually read. The formatted text is written to stream.
+static void format_args(struct print_stream *stream, const char * restrict format_str, struct print_args *args)
+{
+    uint32_t read_index = 0;
 
     // read the format string until we reach the end
     while(format_str[read_index] != '\0'){
@@ -203,471 +543,772 @@ int32_t vsnprintf_(char * restrict out_str, uint32_t buf_len, const char * restr
             read_index++;
         }
 
-        uint32_t copy_len = 0;
-        // if we read further than out_str can hold
-        if((read_index - read_start) > out_str_len){
-            // only copy over what out_str can hold
-            copy_len = out_str_len;
-        }else{
-            // copy everything
-            copy_len = read_index - read_start;
-        }
-        // regardless, record max length to max_str_len
-        max_str_len += read_index - read_start;
-        strncpy_(&out_str[write_index], &format_str[read_start], copy_len);
-        write_index += copy_len;
-        out_str_len -= copy_len;
+        // copy everything up to the '%' or '\0'
+        stream_write(stream, &format_str[read_start], read_index - read_start);
 
         // if we reached the special format character
         if(format_str[read_index] == '%'){
-            // handle formatting
-            struct format_flags flags ={
-                // make some default assumptions
-                .fill_zero = false,
-                .left_align = false,
-                .positive_space = false,
-                .display_sign = false,
-                .min_width = 0,
-                .display_prefix = false,
-                .capitalize = false,
-                .is_negative = false,
-                .base = 10
-            };
-            uint32_t value;
-            // skip '%'
-            read_index++;
+            printf_op op;
+            // skip '%', then read everything up to and including the conversion character
+            read_index = parse_spec(format_str, read_index + 1, &op);
+            convert_op(stream, &op, args);
+        }
+    }
+}
 
-            //check for flags, and update the format_flags struct accordingly
+// reads the conversion spec that starts at format_str[read_index] (just after the '%') into op
+// op's literal text isn't touched
+// returns the index of the first character after the spec
+static uint32_t parse_spec(const char * restrict format_str, uint32_t read_index, printf_op *op)
+{
+    op->flags = 0;
+    op->min_width = 0;
+    op->precision = 0;
+
+    //check for flags, and update op's flags accordingly
 flag_check:
-            switch(format_str[read_index]){
-                case '0':
-                    flags.fill_zero = true;
-                    read_index++;
-                    goto flag_check;
-                case '-':
-                    flags.left_align = true;
-                    read_index++;
-                    goto flag_check;
-                case ' ':
-                    flags.positive_space = true;
-                    flags.sign_space = true;
-                    read_index++;
-                    goto flag_check;
-                case '+':
-                    flags.display_sign = true;
-                    flags.sign_space = true;
-                    read_index++;
-                    goto flag_check;
-                case '#':
-                    flags.display_prefix = true;
-                    read_index++;
-                    goto flag_check;
-                default:
-                    break;
-            }
+    switch(format_str[read_index]){
+        case '0':
+            op->flags |= OP_FILL_ZERO;
+            read_index++;
+            goto flag_check;
+        case '-':
+            op->flags |= OP_LEFT_ALIGN;
+            read_index++;
+            goto flag_check;
+        case ' ':
+            op->flags |= OP_POSITIVE_SPACE;
+            read_index++;
+            goto flag_check;
+        case '+':
+            op->flags |= OP_DISPLAY_SIGN;
+            read_index++;
+            goto flag_check;
+        case '#':
+            op->flags |= OP_DISPLAY_PREFIX;
+            read_index++;
+            goto flag_check;
+        default:
+            break;
+    }
 
-            // check for variable field width
-            if(format_str[read_index] == '*'){
-                // if using variable field width, its value is found in the next argument
-                int32_t var_field_width = va_arg(arg, int32_t);
-                // if the value is negative, treat it as a '-' flag followed by field width
-                if(var_field_width < 0){
-                    flags.min_width = -var_field_width;
-                    flags.left_align = true;
-                }else{
-                    flags.min_width = var_field_width;
-                }
-                read_index++;
-            }else{  // check for pre-defined field width
-            while(format_str[read_index] >= '0' && format_str[read_index] <= '9'){
-                // since we are reading left to right, each digit we read is worth 10x as much as the next digit
-                flags.min_width = flags.min_width * 10;
-                // subtracting the character for '0' is a quick way to convert char representation to actual number
-                flags.min_width += format_str[read_index] - '0';
-                read_index++;
-                }
-            }
+    // check for variable field width
+    if(format_str[read_index] == '*'){
+        // if using variable field width, its value is found in the next argument
+        op->flags |= OP_WIDTH_ARG;
+        read_index++;
+    }else{  // check for pre-defined field width
+        op->min_width = parse_digits(format_str, &read_index);
+    }
 
-            // additional conversion work is done when this variable is true
-            bool run_convert_number = false;
-
-            //get conversion specifier
-            switch(format_str[read_index++]){
-                case 'b':
-                {
-                    value = va_arg(arg, uint32_t);
-                    run_convert_number = true;
-                    flags.base = 2;
-                    // binary numbers can't be negative
-                    flags.positive_space = false;
-                    flags.display_sign = false;
-                    flags.sign_space = false;
-                    break;
-                }
-                case 'c':
-                {
-                    value = va_arg(arg, uint32_t);
-                    if(out_str_len != 0){
-                        out_str[write_index++] = (char)value;
-                        out_str_len--;
-                    }
-                    max_str_len++;
-                    break;
-                }
-                case 'd':
-                    // fall through
-                case 'i':
-                {
-                    value = va_arg(arg, uint32_t);
-                    // decimal numbers can be represented as negative
-                    if((int32_t)value < 0){
-                        flags.is_negative = true;
-                        flags.sign_space = true;
-                        //make it positive
-                        value = -(int32_t)value;
-                    }
-                    run_convert_number = true;
-                    flags.base = 10;
-                    break;
-                }
-                case 'p':
-                {
-                    value = va_arg(arg, uint32_t);
-                    run_convert_number = true;
-                    flags.base = 16;
-                    // pointers always have a prefix of "0x"
-                    flags.display_prefix = true;
-                    break;
-                }
-                case 's':
-                {
-                    const char *arg_str = va_arg(arg, char*);
-                    // str_len is the length of the string we wanted to insert
-                    // but if it's too long then it gets truncated
-                    int32_t str_len = insert_string(&out_str[write_index], 
-                                                out_str_len, arg_str, flags);
-                    // update write_index and out_str_len with the actual change in length
-                    if((uint32_t)str_len > out_str_len){
-                        write_index += out_str_len;
-                        out_str_len = 0;
-                    }else{
-                        write_index += str_len;
-                        out_str_len -= str_len;
-                    }
-                    // max_str_len always gets updated with the maximum length
-                    max_str_len += str_len;
-                    break;
-                }
-                case 'u':
-                {
-                    value = va_arg(arg, uint32_t);
-                    run_convert_number = true;
-                    flags.base = 10;
-                    // while some decimal numbers are allowed to be negative, unsigned
-                    // decimal numbers are not
-                    flags.display_sign = false;
-                    flags.sign_space = false;
-                    break;
-                }
-                case 'X':
-                {
-                    value = va_arg(arg, uint32_t);
-                    run_convert_number = true;
-                    flags.base = 16;
-                    flags.capitalize = true;
-                    // hexadecimal numbers are not allowed to be negative
-                    flags.positive_space = false;
-                    flags.display_sign = false;
-                    flags.sign_space = false;
-                    break;
-                }
-                case 'x':
-                {
-                    value = va_arg(arg, uint32_t);
-                    run_convert_number = true;
-                    flags.base = 16;
-                    // hexadecimal numbers are not allowed to be negative
-                    flags.positive_space = false;
-                    flags.display_sign = false;
-                    flags.sign_space = false;
-                    break;
-                }
-                case '%':
-                {
-                    if(out_str_len != 0){
-                        out_str[write_index++] = '%';
-                        out_str_len--;
-                    }
-                    max_str_len++;
-                    break;
-                }
-            }
-            // if the number needs additional conversion, do that now
-            if(run_convert_number == true){
-                // num_str_len is the max potential length of the converted number (ignoring out_str_len)
-                uint32_t num_str_len = convert_number(&out_str[write_index], out_str_len, value, flags);
-                // update write_index and out_str_len with the actual length written
-                if(num_str_len > out_str_len){
-                    write_index += out_str_len;
-                    out_str_len = 0;
-                }else{
-                    write_index += num_str_len;
-                    out_str_len -= num_str_len;
-                }
-                // always update max_str_len with the max potential length
-                max_str_len += num_str_len;
-            }
+    // check for precision
+    if(format_str[read_index] == '.'){
+        read_index++;
+        op->flags |= OP_HAS_PRECISION;
+        if(format_str[read_index] == '*'){
+            op->flags |= OP_PRECISION_ARG;
+            read_index++;
+        }else{
+            // a '.' on its own means a precision of 0
+            op->precision = parse_digits(format_str, &read_index);
         }
     }
 
-    // terminate the string
-    out_str[write_index++] = '\0';
-    // return the max potential length
-    return max_str_len;
+    // check for a length modifier. "l" is long and "ll" is long long.
+    // long is 32 bits on Cortex-M (but 64 bits on most PCs), and long long is always 64 bits
+    if(format_str[read_index] == 'l'){
+        read_index++;
+        if(format_str[read_index] == 'l'){
+            read_index++;
+            op->flags |= OP_LONG_LONG;
+        }else if(sizeof(long) == sizeof(uint64_t)){
+            op->flags |= OP_LONG_LONG;
+        }
+    }
 
+    // get conversion specifier
+    op->conversion = format_str[read_index];
+    // a '%' at the very end has no conversion, and the '\0' must not be skipped
+    if(op->conversion != '\0'){
+        read_index++;
+    }
+    return (read_index);
 }
 
-uint32_t strlen_(const char * restrict str)
+// reads a field width or precision written in the format string, and moves *read_index past it
+// it is kept to 16 bits, so anything bigger is cut down to 65535
+static uint16_t parse_digits(const char * restrict format_str, uint32_t *read_index)
 {
-    uint32_t len = 0;
+    uint32_t number = 0;
+    while(format_str[*read_index] >= '0' && format_str[*read_index] <= '9'){
+        // since we are reading left to right, each digit we read is worth 10x as much as the next digit
+        number = number * 10;
+        // subtracting the character for '0' is a quick way to convert char representation to actual number
+        number += format_str[*read_index] - '0';
+        if(number > UINT16_MAX){
+            number = UINT16_MAX;
+        }
+        (*read_index)++;
+    }
+    return ((uint16_t)number);
+}
 
-    // increment until we hit the string terminating character
-    while(str[len++] != '\0');
+// prints the conversion op describes, taking its arguments (if any) from args
+static void convert_op(struct print_stream *stream, const printf_op *op, struct print_args *args)
+{
+    struct format_flags flags ={
+        .fill_zero = ((op->flags & OP_FILL_ZERO) != 0),
+        .left_align = ((op->flags & OP_LEFT_ALIGN) != 0),
+        .positive_space = ((op->flags & OP_POSITIVE_SPACE) != 0),
+        .display_sign = ((op->flags & OP_DISPLAY_SIGN) != 0),
+        .sign_space = ((op->flags & (OP_POSITIVE_SPACE | OP_DISPLAY_SIGN)) != 0),
+        .min_width = op->min_width,
+        .display_prefix = ((op->flags & OP_DISPLAY_PREFIX) != 0),
+        .capitalize = false,
+        .long_long = ((op->flags & OP_LONG_LONG) != 0),
+        .is_negative = false,
+        .has_precision = ((op->flags & OP_HAS_PRECISION) != 0),
+        .precision = op->precision,
+        .base = 10
+    };
+    uint64_t value;
+
+    if((op->flags & OP_WIDTH_ARG) != 0){
+        int32_t var_field_width = NEXT_ARG(args, int32_t);
+        // if the value is negative, treat it as a '-' flag followed by field width
+        if(var_field_width < 0){
+            flags.min_width = -var_field_width;
+            flags.left_align = true;
+        }else{
+            flags.min_width = var_field_width;
+        }
+    }
+    if((op->flags & OP_PRECISION_ARG) != 0){
+        // a negative precision argument is the same as leaving the precision out
+        int32_t var_precision = NEXT_ARG(args, int32_t);
+        if(var_precision < 0){
+            flags.has_precision = false;
+        }else{
+            flags.precision = var_precision;
+        }
+    }
 
-    // return the length of the string excluding the null byte
-    return (len - 1);
+    // additional conversion work is done when this variable is true
+    bool run_convert_number = false;
+
+    switch(op->conversion){
+#if PRINTF_BINARY
+        case 'b':
+        {
+            value = UNSIGNED_ARG(args, flags);
+            run_convert_number = true;
+            flags.base = 2;
+            // binary numbers can't be negative
+            flags.positive_space = false;
+            flags.display_sign = false;
+            flags.sign_space = false;
+            break;
+        }
+#endif
+        case 'c':
+        {
+            value = NEXT_ARG(args, uint32_t);
+            stream_fill(stream, (char)value, 1);
+            break;
+        }
+        case 'd':
+            // fall through
+        case 'i':
+        {
+            int64_t signed_value = (flags.long_long == true) ? NEXT_ARG(args, int64_t) : NEXT_ARG(args, int32_t);
+            value = (uint64_t)signed_value;
+            // decimal numbers can be represented as negative
+            if(signed_value < 0){
+                flags.is_negative = true;
+                flags.sign_space = true;
+                //make it positive
+                value = -value;
+            }
+            run_convert_number = true;
+            flags.base = 10;
+            break;
+        }
+#if PRINTF_FLOAT
+        case 'F':
+            // 'F' is the same as 'f', but prints "INF" and "NAN" in capitals
+            flags.capitalize = true;
+            // fall through
+        case 'f':
+        {
+            // float arguments are promoted to double
+            convert_double(stream, NEXT_ARG(args, double), flags);
+            break;
+        }
+        case 'q':
+        {
+            // a fixed-point number takes 2 arguments: how many of its bits are
+            // fraction bits (n in Qm.n), and then the number itself
+            uint32_t frac_bits = NEXT_ARG(args, uint32_t);
+            convert_q(stream, NEXT_ARG(args, int32_t), frac_bits, flags);
+            break;
+        }
+#endif
+        case 'p':
+        {
+            value = (uintptr_t)NEXT_ARG(args, void *);
+            run_convert_number = true;
+            flags.base = 16;
+            // pointers always have a prefix of "0x"
+            flags.display_prefix = true;
+            break;
+        }
+        case 's':
+        {
+            const char *arg_str = NEXT_ARG(args, char*);
+            insert_string(stream, arg_str, flags);
+            break;
+        }
+        case 'u':
+        {
+            value = UNSIGNED_ARG(args, flags);
+            run_convert_number = true;
+            flags.base = 10;
+            // while some decimal numbers are allowed to be negative, unsigned
+            // decimal numbers are not
+            flags.display_sign = false;
+            flags.sign_space = false;
+            break;
+        }
+        case 'X':
+        {
+            value = UNSIGNED_ARG(args, flags);
+            run_convert_number = true;
+            flags.base = 16;
+            flags.capitalize = true;
+            // hexadecimal numbers are not allowed to be negative
+            flags.positive_space = false;
+            flags.display_sign = false;
+            flags.sign_space = false;
+            break;
+        }
+        case 'x':
+        {
+            value = UNSIGNED_ARG(args, flags);
+            run_convert_number = true;
+            flags.base = 16;
+            // hexadecimal numbers are not allowed to be negative
+            flags.positive_space = false;
+            flags.display_sign = false;
+            flags.sign_space = false;
+            break;
+        }
+        case '%':
+        {
+            stream_fill(stream, '%', 1);
+            break;
+        }
+    }
+    // if the number needs additional conversion, do that now
+    if(run_convert_number == true){
+        convert_number(stream, value, flags);
+    }
+}
+
+// the next word of args, or 0 if there are none left
+static inline uintptr_t next_word(struct print_args *args)
+{
+    if(args->num_words == 0){
+        return (0);
+    }
+    args->num_words--;
+    return (*args->words++);
 }
 
+// an aligned word never crosses into another page, so reading the rest of the word holding the '\0'
+// is safe on the hardware. It can still run past the end of the source array, which ASan would report
+__attribute__((no_sanitize_address))
 char * strncpy_(char * restrict dest_str, const char * restrict src_str, uint32_t len)
 {
-    uint32_t read_index = 0;
+    uint32_t copy_len = 0;
 
-    // while src_str isn't empty and we haven't copied over len characters
-    while((read_index < len) && (src_str[read_index] != '\0'))
+    // find how many characters to copy, stopping at the '\0' or after len characters
+    while((copy_len < len) && (src_str[copy_len] != '\0'))
     {
-        dest_str[read_index] = src_str[read_index];
-        read_index++;
+        // whole words can be skipped once src_str is aligned, as long as none of their bytes is '\0'
+        // once a word has one, the rest of it is checked byte by byte
+        if(((((uintptr_t)&src_str[copy_len]) & 0x03) == 0) && ((len - copy_len) >= sizeof(uint32_t)) &&
+           (WORD_HAS_ZERO(*(const aliasWord *)&src_str[copy_len]) == 0))
+        {
+            copy_len += sizeof(uint32_t);
+            continue;
+        }
+        copy_len++;
     }
 
+    // copy the characters over in one go
+    memcpy_(dest_str, src_str, copy_len);
     // if src_str was shorter than len, pad the remaining string with '\0'
     // because why not?
-    while(read_index < len)
-    {
-        dest_str[read_index] = '\0';
-        read_index++;
-    }
+    memset_(&dest_str[copy_len], '\0', len - copy_len);
 
     // return the newly created string
     return(dest_str);
 }
 
 /*
-    insert the input string into the output string.
-    insert a maximum of out_str_len characters.
+    insert the input string into the stream.
     if min_width > in_str length, add padding to beginning or end
     depending on if it's left-aligned.
-    return number of characters written if you ignore out_str_len
 */
-static int32_t insert_string(char * restrict out_str, uint32_t out_str_len, 
-                    const char * restrict in_str, struct format_flags flags)
+static void insert_string(struct print_stream *stream, const char * restrict in_str,
+                    struct format_flags flags)
 {
-    uint32_t in_str_len = strlen_(in_str);
-    uint32_t write_index = 0;
-    uint32_t pad_len = 0;   // how much to pad (if there's space)
-    int32_t max_len = 0;   // max length we would write if you ignore out_str_len
+    uint32_t in_str_len;
+    // a precision is the most characters of the string to print
+    if(flags.has_precision){
+        in_str_len = 0;
+        while((in_str_len < flags.precision) && (in_str[in_str_len] != '\0')){
+            in_str_len++;
+        }
+    }else{
+        in_str_len = strlen_(in_str);
+    }
+    uint32_t pad_len = 0;   // how much to pad
     // determine if there needs to be padding
-    // max_len is the greater of flags.min_width and in_str_len
     if(flags.min_width > in_str_len){
         pad_len = flags.min_width - in_str_len;
-        max_len = flags.min_width;
-    }else{
-        max_len = in_str_len;
     }
 
     // if we should pad spaces before we insert the string
-    if((flags.left_align == false) && (pad_len > 0)){
-        while((write_index < pad_len) && (out_str_len > 0)){
-            out_str[write_index++] = ' ';
-            out_str_len--;
-        }
+    if(flags.left_align == false){
+        stream_fill(stream, ' ', pad_len);
     }
 
-    // calculate how much space is left to copy characters over
-    uint32_t copy_len = 0;
-    if(out_str_len > in_str_len){
-        copy_len = in_str_len;
-    }else{
-        copy_len = out_str_len;
-    }
-    // copy the input string over to the output string buffer
-    strncpy_(&out_str[write_index], in_str, copy_len);
-    write_index += copy_len;
-    out_str_len -= copy_len;
+    // copy the input string over to the stream
+    stream_write(stream, in_str, in_str_len);
 
     // if we should pad spaces after we insert the string
-    if((flags.left_align == true) && (pad_len > 0)){
-        // and if the input string wasn't wider than the min_width and
-        // the output string has space to accept more characters
-        while((write_index < flags.min_width) && (out_str_len > 0)){
-            out_str[write_index++] = ' ';
-            out_str_len--;
-        }
+    if(flags.left_align == true){
+        stream_fill(stream, ' ', pad_len);
     }
-    return max_len;
 }
 
-static int32_t convert_number(char * restrict out_str, uint32_t out_str_len,
-                        uint32_t value, struct format_flags flags)
+static void convert_number(struct print_stream *stream, uint64_t value,
+                    struct format_flags flags)
 {
+    // the sign and prefix are collected here, in the order they are printed
+    char head[3];
+    uint32_t head_len = format_sign(head, flags);
+    // the digits are written here, in the order they are printed
     char num_buffer[NUM_MAX_WIDTH];
-    uint32_t cur_val = value;
-    uint32_t num_str_len = 0;
-
-    // calculate what each digit should be
-    // this algorithm produces a backwards string
-    // for example, the number 1234 will come out as "4321"
-    do{
-        // modding the current value by the number base tells you what the
-        // least-significant digit should be
-        uint32_t digit = cur_val % flags.base;
-        char c_digit;
-        // map the number to its character representation
-        if(flags.capitalize == true){
-            c_digit = uc_map[digit];
-        }else{
-            c_digit = lc_map[digit];
-        }
-        // add the character to the working buffer collecting the backwards number
-        num_buffer[num_str_len++] = c_digit;
-        // divide the current value by the number base sets us up to take the modulus
-        // again and figure out the next digit
-        cur_val /= flags.base;
-    // do this at least once, but continue until there are no more numbers to figure out
-    }while(cur_val != 0);  
-
-    // if the number is binary or hex and there is supposed to be a prefix to the number,
-    // tack it on now
-    if(flags.display_prefix == true){
-        if(flags.base == 16){
-            // adds "x0" to the end of the buffer, which eventually gets 
-            // flipped to the prefix "0x"
-            num_buffer[num_str_len++] = 'x';
-            num_buffer[num_str_len++] = '0';
-        }else if(flags.base == 2){
-            // adds "b0" to the end of the buffer, which eventually gets 
-            // flipped to the prefix "0b"
-            num_buffer[num_str_len++] = 'b';
-            num_buffer[num_str_len++] = '0';
-        }else{  // flag base is 10 and we don't print a prefix for that
-            flags.display_prefix = false;
+    uint32_t num_str_len;
+
+    if(flags.base == 10){
+        num_str_len = format_decimal64(num_buffer, value);
+    }else{
+        const char *map = (flags.capitalize == true) ? uc_map : lc_map;
+        const uint32_t bits_per_digit = (flags.base == 16) ? 4 : 1;
+        num_str_len = format_bits(num_buffer, value, bits_per_digit, map);
+
+        // if the number is binary or hex and there is supposed to be a prefix to the number,
+        // tack it on now
+        if(flags.display_prefix == true){
+            head[head_len++] = '0';
+            head[head_len++] = (flags.base == 16) ? 'x' : 'b';
         }
     }
 
+    print_padded(stream, head, head_len, num_buffer, num_str_len, NULL, 0, flags);
+}
+
+// writes the sign a number should be printed with (if any) into head
+// returns how many characters were written (0 or 1)
+static uint32_t format_sign(char *head, struct format_flags flags)
+{
     // order matters for these if statements. 
     // if negative, a minus sign should always be displayed
     // a plus sign should override a space if both are flagged
-    if(flags.positive_space == true){
-        num_buffer[num_str_len] = ' ';
-    }
-    if(flags.display_sign == true){
-        num_buffer[num_str_len] = '+';
+    // if any of the three flags are true, sign_space will also be true
+    if(!flags.sign_space){
+        return 0;
     }
     if(flags.is_negative){
-        num_buffer[num_str_len] = '-';
+        head[0] = '-';
+    }else if(flags.display_sign == true){
+        head[0] = '+';
+    }else{
+        head[0] = ' ';
     }
-    // if any of the three flags tested were true, sign_space will also be true
-    // sign_space tells us we need to leave space for one of the 3 signs (+ -)
-    if(flags.sign_space){
-        num_str_len++;
+    return 1;
+}
+
+// writes the decimal digits of value into num_buffer (which must hold at least 10)
+// returns how many digits were written
+static uint32_t format_decimal(char *num_buffer, uint32_t value)
+{
+    // figure out how many digits the number has, so every digit can be written
+    // straight into its final position. No reversing needed afterwards.
+    uint32_t num_str_len = count_decimal_digits(value);
+    uint32_t i = num_str_len;
+    // work out 2 digits at a time. Dividing by a constant compiles to a multiply
+    // and a shift instead of a division instruction
+    while(value >= 100){
+        uint32_t pair = value % 100;
+        value /= 100;
+        num_buffer[--i] = decimal_pairs[(pair * 2) + 1];
+        num_buffer[--i] = decimal_pairs[pair * 2];
+    }
+    if(value >= 10){
+        num_buffer[--i] = decimal_pairs[(value * 2) + 1];
+        num_buffer[--i] = decimal_pairs[value * 2];
+    }else{
+        num_buffer[--i] = (char)('0' + value);
     }
+    return num_str_len;
+}
 
-    // reverse the backwards string and add appropriate padding
-    // max_len is the max length the number would be if you ignore out_str_len
-    int32_t max_len = reverse_string(out_str, out_str_len, 
-                            num_buffer, num_str_len, flags);
+// writes the decimal digits of a 64-bit value into num_buffer (which must hold at least 20)
+// returns how many digits were written
+// a 64-bit division is a libgcc call that takes hundreds of cycles on a Cortex-M4, so instead,
+// value is split into 16-bit parts, and the parts are added up in base 10000 using
+// 2^16 = 6,5536 and 2^32 = 42,9496,7296 and 2^48 = 281,4749,7671,0656 (one base 10000 digit
+// between commas). Only 32-bit multiplies and divisions by the constant 10000 are needed
+static uint32_t format_decimal64(char *num_buffer, uint64_t value)
+{
+    if((value >> 32) == 0){
+        return format_decimal(num_buffer, (uint32_t)value);
+    }
 
-    // return the max theoretical length
-    return max_len;
+    const uint32_t d0 = (uint32_t)value & 0xFFFF;
+    const uint32_t d1 = (uint32_t)(value >> 16) & 0xFFFF;
+    const uint32_t d2 = (uint32_t)(value >> 32) & 0xFFFF;
+    const uint32_t d3 = (uint32_t)(value >> 48);
+    // limbs[n] is the base 10000 digit worth 10000^n. Each sum stays well under 2^32
+    uint32_t limbs[5];
+    uint32_t sum = (656 * d3) + (7296 * d2) + (5536 * d1) + d0;
+    limbs[0] = sum % 10000;
+    sum = (sum / 10000) + (7671 * d3) + (9496 * d2) + (6 * d1);
+    limbs[1] = sum % 10000;
+    sum = (sum / 10000) + (4749 * d3) + (42 * d2);
+    limbs[2] = sum % 10000;
+    sum = (sum / 10000) + (281 * d3);
+    limbs[3] = sum % 10000;
+    limbs[4] = sum / 10000;
+
+    // value is at least 2^32, so limbs[2] or a higher one isn't 0
+    uint32_t top = 4;
+    while(limbs[top] == 0){
+        top--;
+    }
+    // the top limb is printed without leading zeros, and every limb below it as 4 digits
+    uint32_t num_str_len = format_decimal(num_buffer, limbs[top]);
+    while(top > 0){
+        top--;
+        uint32_t high_pair = limbs[top] / 100;
+        uint32_t low_pair = limbs[top] % 100;
+        num_buffer[num_str_len++] = decimal_pairs[high_pair * 2];
+        num_buffer[num_str_len++] = decimal_pairs[(high_pair * 2) + 1];
+        num_buffer[num_str_len++] = decimal_pairs[low_pair * 2];
+        num_buffer[num_str_len++] = decimal_pairs[(low_pair * 2) + 1];
+    }
+    return num_str_len;
 }
 
-static int32_t reverse_string(char * restrict out_str, uint32_t out_str_len, 
-                    const char * restrict in_str, uint32_t in_str_len, 
+// writes value into num_buffer in base 2 (bits_per_digit = 1) or base 16 (bits_per_digit = 4)
+// returns how many digits were written
+static uint32_t format_bits(char *num_buffer, uint64_t value, uint32_t bits_per_digit, const char *map)
+{
+    // base 2 and base 16 digits are just groups of 1 or 4 bits,
+    // so they can be picked out with shifts and masks
+    const uint32_t digit_mask = (1UL << bits_per_digit) - 1;
+    uint32_t high = (uint32_t)(value >> 32);
+    uint32_t low = (uint32_t)value;
+    // number of significant bits, rounded up to a whole number of digits
+    // (low | 1) makes sure 0 is printed as a single digit
+    uint32_t num_bits = (high != 0) ? (64 - __builtin_clz(high)) : (32 - __builtin_clz(low | 1));
+    uint32_t num_str_len = (num_bits + bits_per_digit - 1) / bits_per_digit;
+
+    uint32_t i = num_str_len;
+    // the digits in the low half are all worked out with 32-bit shifts.
+    // both bit counts divide 32, so no digit spans the two halves
+    for(uint32_t j = 0; (j < (32 / bits_per_digit)) && (i > 0); j++){
+        num_buffer[--i] = map[low & digit_mask];
+        low >>= bits_per_digit;
+    }
+    while(i > 0){
+        num_buffer[--i] = map[high & digit_mask];
+        high >>= bits_per_digit;
+    }
+    return num_str_len;
+}
+
+// prints a number made of head (the sign and prefix), body (the digits) and tail
+// (anything after the digits, like a fraction), padded out to flags.min_width
+static void print_padded(struct print_stream *stream, const char *head, uint32_t head_len,
+                    const char *body, uint32_t body_len, const char *tail, uint32_t tail_len,
                     struct format_flags flags)
 {
+    uint32_t len = head_len + body_len + tail_len;
     uint32_t pad_len = 0;
-
     // if there is padding, calculate it
-    if(flags.min_width > in_str_len){
-        pad_len = flags.min_width - in_str_len;
+    if(flags.min_width > len){
+        pad_len = flags.min_width - len;
     }
 
-    // this is the maximum length of the string if you ignore out_str_len
-    int32_t max_len = pad_len + in_str_len;
-    
-    // if the number is left-aligned, print it first before printing any padding any
-    // prefixes or signs are located at the end of in_str so they will be printed first
     if(flags.left_align == true){
-        while((out_str_len > 0) && (in_str_len > 0)){
-            out_str_len--;
-            in_str_len--;            
-            *(out_str++) = in_str[in_str_len];
-        }
-        // if there is still room in out_str and there is supposed to be 
-        // additional padding, print it now
+        // if the number is left-aligned, print it first before printing any padding
         // note: when a number is left-aligned, it cannot use 0's for padding
-        while((out_str_len > 0) && (pad_len > 0)){
-            out_str_len--;
-            pad_len--;            
-            *(out_str++) = ' ';
-        }
-    }else{  // right align number
-        if(flags.fill_zero == true){
-            // if there is a sign, print that before the prefix and/or filling with zeros
-            if((flags.sign_space == true) && (out_str_len > 0)){
-                *(out_str++) = in_str[--in_str_len];
-                out_str_len--;
-            }
-            // if there is a prefix, print that now as well
-            if(flags.display_prefix == true){
-                uint32_t prefix_len = 2;    //prefix is always 2 characters long
-                while((out_str_len > 0) && (prefix_len > 0)){
-                    *(out_str++) = in_str[--in_str_len];
-                    out_str_len--;
-                    prefix_len--;
-                }
-            }
-            // if there are supposed to be padding 0's, print them now
-            while((out_str_len > 0) && (pad_len > 0)){
-                out_str_len--;
-                pad_len--;                
-                *(out_str++) = '0';
-            }
-            // finally, print the actual number in in_str
-            while((out_str_len > 0) && (in_str_len > 0)){
-                out_str_len--;
-                in_str_len--;                
-                *(out_str++) = in_str[in_str_len];
-            }
+        stream_write(stream, head, head_len);
+        stream_write(stream, body, body_len);
+        stream_write(stream, tail, tail_len);
+        stream_fill(stream, ' ', pad_len);
+    }else if(flags.fill_zero == true){
+        // any sign or prefix comes before the padding 0's
+        stream_write(stream, head, head_len);
+        stream_fill(stream, '0', pad_len);
+        stream_write(stream, body, body_len);
+        stream_write(stream, tail, tail_len);
+    }else{
+        // right align number and pad with spaces
+        stream_fill(stream, ' ', pad_len);
+        stream_write(stream, head, head_len);
+        stream_write(stream, body, body_len);
+        stream_write(stream, tail, tail_len);
+    }
+}
+
+// returns how many digits value has when it is printed in decimal
+static uint32_t count_decimal_digits(uint32_t value)
+{
+    uint32_t num_digits = 1;
+    while((num_digits < COUNT_OF(powers_of_10)) && (value >= powers_of_10[num_digits])){
+        num_digits++;
+    }
+    return num_digits;
+}
+
+#if PRINTF_FLOAT
+/***** Fixed Point Functions *****/
+// the STM32WL has no FPU, so %f takes the double apart by its bits and never does any
+// floating point math. The whole part is printed like any other number, and the fraction
+// is turned into a 64-bit binary fraction (frac / 2^64) for convert_fixed()
+static void convert_double(struct print_stream *stream, double value, struct format_flags flags)
+{
+    union {
+        double d;
+        uint64_t u;
+    } bits = { .d = value };
+    uint64_t mantissa = bits.u & ((1ULL << 52) - 1);
+    int32_t exponent = (int32_t)((bits.u >> 52) & 0x7FF);
+
+    if((bits.u >> 63) != 0){
+        flags.is_negative = true;
+        flags.sign_space = true;
+    }
+
+    // the largest exponent means infinity, or NaN if there's a mantissa
+    // and anything with more than 64 bits in its whole part is too big to print
+    const char *special = NULL;
+    if(exponent == 0x7FF){
+        special = (mantissa != 0) ? "nan" : "inf";
+    }else if(exponent >= (1023 + 64)){
+        special = "ovf";
+    }
+    if(special != NULL){
+        char str[3];
+        for(uint32_t i = 0; i < 3; i++){
+            str[i] = (flags.capitalize == true) ? (char)(special[i] - ('a' - 'A')) : special[i];
+        }
+        char head[1];
+        uint32_t head_len = format_sign(head, flags);
+        flags.fill_zero = false;
+        print_padded(stream, head, head_len, str, 3, NULL, 0, flags);
+        return;
+    }
+
+    // value = mantissa * 2^shift. Subnormal numbers have no hidden 1 bit
+    if(exponent == 0){
+        exponent = 1;
+    }else{
+        mantissa |= (1ULL << 52);
+    }
+    int32_t shift = exponent - 1075;
+
+    uint64_t int_part;
+    uint64_t frac;
+    if(shift >= 0){
+        // no fraction bits at all (the whole part has at most 64 bits, so shift is at most 11)
+        int_part = mantissa << shift;
+        frac = 0;
+    }else if(shift > -64){
+        int_part = mantissa >> -shift;
+        frac = mantissa << (64 + shift);
+    }else if(shift > -(64 + 53)){
+        // the number is less than 2^-11, so some of the lowest bits are dropped.
+        // if any of them were set, so is the lowest bit that's kept, so the rounding still
+        // knows the number was a little more than what's left
+        uint32_t dropped = -shift - 64;
+        int_part = 0;
+        frac = (mantissa >> dropped) | ((mantissa & ((1ULL << dropped) - 1)) != 0);
+    }else{
+        int_part = 0;
+        frac = 0;
+    }
+    convert_fixed(stream, int_part, frac, flags);
+}
+
+// %q prints a signed Qm.n fixed-point number: value / 2^frac_bits
+static void convert_q(struct print_stream *stream, int32_t value, uint32_t frac_bits,
+                    struct format_flags flags)
+{
+    uint32_t magnitude = (uint32_t)value;
+    if(value < 0){
+        flags.is_negative = true;
+        flags.sign_space = true;
+        magnitude = -magnitude;
+    }
+    // the sign takes up the 32nd bit
+    if(frac_bits > 31){
+        frac_bits = 31;
+    }
+
+    uint32_t int_part = magnitude >> frac_bits;
+    uint64_t frac = 0;
+    if(frac_bits > 0){
+        // shifting the fraction bits to the top of 64 bits drops the whole part off the end
+        frac = (uint64_t)magnitude << (64 - frac_bits);
+    }
+    convert_fixed(stream, int_part, frac, flags);
+}
+
+// prints int_part and precision digits of frac, a binary fraction (frac / 2^64)
+// each digit comes from multiplying the fraction by 10, so there's no division anywhere.
+// the last digit is rounded to nearest (with ties going to even, the same as libc)
+static void convert_fixed(struct print_stream *stream, uint64_t int_part, uint64_t frac,
+                    struct format_flags flags)
+{
+    uint32_t precision = (flags.has_precision == true) ? flags.precision : FIXED_DEFAULT_PRECISION;
+    if(precision > FIXED_MAX_PRECISION){
+        precision = FIXED_MAX_PRECISION;
+    }
+
+    // the '.' and the fraction digits, which make up the tail of the number
+    char frac_buffer[FIXED_MAX_PRECISION + 1];
+    frac_buffer[0] = '.';
+    for(uint32_t i = 1; i <= precision; i++){
+        frac_buffer[i] = (char)('0' + next_fraction_digit(&frac));
+    }
+
+    // whatever is left of the fraction decides the rounding
+    const uint64_t half = 1ULL << 63;
+    bool last_odd = (precision > 0) ? ((frac_buffer[precision] & 1) != 0) : ((int_part & 1) != 0);
+    if((frac > half) || ((frac == half) && last_odd)){
+        uint32_t i = precision;
+        while((i > 0) && (frac_buffer[i] == '9')){
+            frac_buffer[i] = '0';
+            i--;
+        }
+        if(i > 0){
+            frac_buffer[i]++;
+        }else{
+            int_part++;
+        }
+    }
+
+    char head[1];
+    uint32_t head_len = format_sign(head, flags);
+    char num_buffer[NUM_MAX_WIDTH];
+    uint32_t num_str_len = format_decimal64(num_buffer, int_part);
+    // without any digits after it, the '.' is left out too (unless the '#' flag asks for it)
+    uint32_t tail_len = ((precision > 0) || (flags.display_prefix == true)) ? (precision + 1) : 0;
+    print_padded(stream, head, head_len, num_buffer, num_str_len, frac_buffer, tail_len, flags);
+}
+
+// multiplies the binary fraction by 10, and returns the whole number that's pushed
+// out the top, which is the next decimal digit. Only 32x32 bit multiplies are used
+static inline uint32_t next_fraction_digit(uint64_t *frac)
+{
+    uint64_t low = (uint64_t)(uint32_t)*frac * 10;
+    uint64_t high = (uint64_t)(uint32_t)(*frac >> 32) * 10 + (low >> 32);
+    *frac = (high << 32) | (uint32_t)low;
+    return (uint32_t)(high >> 32);
+}
+#endif
 
-        }else{ // right align number and pad with spaces
+/***** Stream Functions *****/
+// write len characters from str to the stream
+static void stream_write(struct print_stream *stream, const char * restrict str, uint32_t len)
+{
+    // empty spans (like a number with no prefix) may not even have a buffer
+    if(len == 0){
+        return;
+    }
+    stream->total_len += len;
 
-            // first, print any spaces necessary for padding
-            while((out_str_len > 0) && (pad_len > 0)){
-                out_str_len--;
-                pad_len--;                
-                *(out_str++) = ' ';
+    uint32_t space = stream->buf_len - stream->write_index;
+    if(len > space){
+        if(stream->sink == NULL){
+            // nowhere to send the characters, so only copy over what fits
+            len = space;
+        }else{
+            // make room by sending what is already in the buffer
+            stream_flush(stream);
+            // if it still can't fit, there's no point copying it, send it straight to the sink
+            if(len > stream->buf_len){
+                stream_sink(stream, str, len);
+                return;
             }
+        }
+    }
+    memcpy_(&stream->buf[stream->write_index], str, len);
+    stream->write_index += len;
+}
+
+// write character c to the stream count times
+static void stream_fill(struct print_stream *stream, char c, uint32_t count)
+{
+    stream->total_len += count;
 
-            // next, print the number including any sign or prefix that may come first
-            while((out_str_len > 0) && (in_str_len > 0)){
-                out_str_len--;
-                in_str_len--;
-                *(out_str++) = in_str[in_str_len];
+    while(count > 0){
+        // if the buffer is full, make room (or stop if there is nowhere to send it)
+        if(stream->write_index == stream->buf_len){
+            if(stream->sink == NULL){
+                return;
             }
+            stream_flush(stream);
+        }
+        // fill as much of the buffer as possible in one go
+        uint32_t chunk = stream->buf_len - stream->write_index;
+        if(chunk > count){
+            chunk = count;
         }
+        memset_(&stream->buf[stream->write_index], (uint8_t)c, chunk);
+        stream->write_index += chunk;
+        count -= chunk;
     }
+}
 
-    // return the max potential length added to out_str
-    return max_len;
+// send everything in the buffer to the sink
+static void stream_flush(struct print_stream *stream)
+{
+    if((stream->sink != NULL) && (stream->write_index > 0)){
+        stream_sink(stream, stream->buf, stream->write_index);
+    }
+    stream->write_index = 0;
 }
 
+// hand len characters to the sink, and count it if the sink doesn't take all of them
+static void stream_sink(struct print_stream *stream, const char *buf, uint32_t len)
+{
+    int32_t sent = stream->sink(stream->sink_ctx, buf, len);
+    if((sent < 0) || ((uint32_t)sent < len)){
+        truncation_count++;
+    }
+}
+
+// the sink printf_ and printfln_ use: everything goes straight to write_()
+static int32_t write_sink(void *ctx, const char *buf, uint32_t len)
+{
+    (void)ctx;
+    return write_(buf, len);
+}
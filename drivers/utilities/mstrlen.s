@@ -0,0 +1,49 @@
+  @ tells the assembler to use the unified instruction set
+  .syntax unified
+  @ this directive selects the thumb (16-bit) instruction set
+  .thumb
+  @ this directive specifies the following symbol is a thumb-encoded function
+  .thumb_func
+  @ align the next variable or instruction on a 2-byte boundary
+  .balign 2
+  @ make the symbol visible to the linker
+  .global strlen_
+  @ marks the symbol as being a function name
+  .type strlen_, STT_FUNC
+strlen_:
+@ r0 = string addr
+@ returns the length of the string (not counting the '\0') in r0
+
+  mov   r1, r0              @ copy string addr into r1, r0 is kept to work out the length at the end
+
+@ check one byte at a time until r1 is 4-byte aligned
+align_chunk:
+  tst   r1, #3              @ check if r1 is 4-byte aligned
+  beq   word_check          @ if so, check a word at a time
+  ldrb  r2, [r1], #1        @ load byte from memory[r1] into r2, then increment r1 by 1
+  cmp   r2, #0              @ check if it is the '\0'
+  bne   align_chunk         @ if not, repeat
+  subs  r0, r1, r0          @ r1 is 1 past the '\0', so the length is r1 - string addr - 1
+  subs  r0, r0, #1
+  bx    lr                  @ exit function
+
+@ r1 is 4-byte aligned, so a whole word can be loaded without ever crossing
+@ into the next memory region, even when the '\0' is the word's first byte
+.balign 4                   @ align the loop to a 4 byte boundary
+word_check:
+  ldr   r2, [r1], #4        @ load word from memory[r1] into r2, then increment r1 by 4
+  sub   r3, r2, #0x01010101 @ subtract 1 from each byte. A byte that was 0 borrows and gets its top bit set
+  bic   r3, r3, r2          @ clear the top bit of any byte whose top bit was already set
+  ands  r3, r3, #0x80808080 @ keep only the top bit of each byte, and update flags
+  beq   word_check          @ if none are set, there is no '\0' in this word, so check the next one
+
+@ the lowest set bit marks the first '\0' (bytes are little-endian, so byte 0 is the lowest)
+  rbit  r3, r3              @ reverse the bits so the first '\0' is marked by the highest set bit
+  clz   r3, r3              @ count leading zeros: 7, 15, 23 or 31 for a '\0' in byte 0, 1, 2 or 3
+  subs  r1, r1, r0          @ number of bytes checked, including this whole word
+  subs  r1, r1, #4          @ don't count this word
+  add   r0, r1, r3, lsr #3  @ add the '\0's byte position in this word (clz / 8)
+  bx    lr                  @ exit function
+
+  .size strlen_, . - strlen_
+
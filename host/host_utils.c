@@ -0,0 +1,76 @@
+// host (PC) versions of the functions that are normally provided by the
+// Cortex-M assembly files and by main.c. This lets mcli.c and mprintf.c be
+// compiled with gcc and run on a PC. Build it with "make host".
+#include "host_utils.h"
+#include "utils.h"
+#include "mprintf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// echo_output decides whether anything printed actually reaches stdout
+static bool echo_output = false;
+// output_count is how many characters have been printed since it was last reset
+static uint64_t output_count = 0;
+
+/*** Replacements for the assembly utilities ***/
+int32_t strcmp_(const char *str1, const char *str2)
+{
+  return strcmp(str1, str2);
+}
+
+void* memmove_(void *destination, const void *source, uint32_t num)
+{
+  return memmove(destination, source, num);
+}
+
+void* memcpy_(void *destination, const void *source, uint32_t num)
+{
+  return memcpy(destination, source, num);
+}
+
+void* memset_(void *destination, uint8_t value, uint32_t num)
+{
+  return memset(destination, value, num);
+}
+
+uint32_t strlen_(const char * restrict str)
+{
+  return strlen(str);
+}
+
+/*** Output functions ***/
+int32_t putchar_(char c)
+{
+  output_count++;
+  if(echo_output){
+    putchar(c);
+  }
+  return c;
+}
+
+int32_t write_(const char *buf, uint32_t len)
+{
+  output_count += len;
+  if(echo_output){
+    fwrite(buf, 1, len, stdout);
+  }
+  return len;
+}
+
+void host_output_echo(bool enable)
+{
+  echo_output = enable;
+}
+
+uint64_t host_output_count(void)
+{
+  return output_count;
+}
+
+void host_output_reset(void)
+{
+  output_count = 0;
+}
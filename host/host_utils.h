@@ -0,0 +1,13 @@
+#ifndef __HOST_UTILS_H
+#define __HOST_UTILS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// if enable is true, everything mcli prints is also written to stdout
+void host_output_echo(bool enable);
+// returns how many characters mcli has printed since the last host_output_reset()
+uint64_t host_output_count(void);
+void host_output_reset(void);
+
+#endif /* __HOST_UTILS_H */
@@ -0,0 +1,144 @@
+// replay harness for the host build of mcli. Build it with "make host".
+// it feeds recorded keystroke streams through cli_input()/cli_process() and reports
+// how fast they were processed, and how many characters mcli printed per character typed.
+// usage: mcli_replay [-n runs] [-b block_size] [-v] recording...
+//   -n  replays each recording this many times (default 1000)
+//   -b  hands the input over in blocks of this size with cli_input_block() (default 1, which uses cli_input())
+//   -v  also prints everything mcli outputs (mostly useful with -n 1)
+#include "mcli.h"
+#include "host_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+// MAX_BLOCK_SIZE is the largest block handed to cli_input_block() at once
+// the ring buffer always leaves 1 byte empty, so it holds 1 less than RX_BUFFER_SIZE (see mcli_config.h)
+#define MAX_BLOCK_SIZE    (RX_BUFFER_SIZE - 1)
+#define DEFAULT_RUNS      1000
+
+static int32_t load_recording(const char *path, char **data, uint32_t *len);
+static double replay(const char *data, uint32_t len, uint32_t runs, uint32_t block_size);
+static double now_seconds(void);
+
+int main(int argc, char* argv[])
+{
+  uint32_t runs = DEFAULT_RUNS;
+  uint32_t block_size = 1;
+  bool verbose = false;
+
+  int opt;
+  while((opt = getopt(argc, argv, "n:b:v")) != -1){
+    switch(opt){
+    case 'n':
+      runs = strtoul(optarg, NULL, 0);
+      break;
+    case 'b':
+      block_size = strtoul(optarg, NULL, 0);
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n runs] [-b block_size] [-v] recording...\n", argv[0]);
+      return 1;
+    }
+  }
+  if((optind >= argc) || (runs == 0) || (block_size == 0) || (block_size > MAX_BLOCK_SIZE)){
+    fprintf(stderr, "usage: %s [-n runs] [-b block_size (1-%u)] [-v] recording...\n", argv[0], MAX_BLOCK_SIZE);
+    return 1;
+  }
+  host_output_echo(verbose);
+
+  if(!verbose){
+    printf("%-32s %10s %12s %14s %12s\n", "recording", "bytes", "seconds", "chars/second", "out/in");
+  }
+  uint64_t total_in = 0;
+  uint64_t total_out = 0;
+  double total_time = 0;
+
+  for(int i = optind; i < argc; i++){
+    char *data;
+    uint32_t len;
+    if(load_recording(argv[i], &data, &len) < 0){
+      fprintf(stderr, "ERROR: unable to read %s\n", argv[i]);
+      return 1;
+    }
+
+    host_output_reset();
+    double seconds = replay(data, len, runs, block_size);
+    uint64_t in = (uint64_t)len * runs;
+    uint64_t out = host_output_count();
+    free(data);
+
+    if(verbose){
+      printf("\n");
+    }
+    printf("%-32s %10u %12.6f %14.0f %12.3f\n", argv[i], len, seconds, in / seconds, (double)out / in);
+    total_in += in;
+    total_out += out;
+    total_time += seconds;
+  }
+
+  if((argc - optind) > 1){
+    printf("%-32s %10llu %12.6f %14.0f %12.3f\n", "total", (unsigned long long)(total_in / runs),
+           total_time, total_in / total_time, (double)total_out / total_in);
+  }
+  return 0;
+}
+
+// reads the whole recording at path into a newly allocated buffer
+// returns 0 if successful, otherwise -1
+static int32_t load_recording(const char *path, char **data, uint32_t *len)
+{
+  FILE *file = fopen(path, "rb");
+  if(file == NULL){
+    return (-1);
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if(size <= 0){
+    fclose(file);
+    return (-1);
+  }
+
+  *data = malloc(size);
+  if((*data == NULL) || (fread(*data, 1, size, file) != (size_t)size)){
+    free(*data);
+    fclose(file);
+    return (-1);
+  }
+  *len = (uint32_t)size;
+  fclose(file);
+  return (0);
+}
+
+// feeds the recording through mcli runs times, calling cli_process() after every block
+// returns how many seconds that took
+static double replay(const char *data, uint32_t len, uint32_t runs, uint32_t block_size)
+{
+  double start = now_seconds();
+  for(uint32_t run = 0; run < runs; run++){
+    for(uint32_t i = 0; i < len; i += block_size){
+      if(block_size == 1){
+        cli_input(data[i]);
+      }else{
+        uint32_t chunk = ((len - i) < block_size) ? (len - i) : block_size;
+        cli_input_block(&data[i], chunk);
+      }
+      cli_process();
+    }
+  }
+  return (now_seconds() - start);
+}
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + (ts.tv_nsec * 1e-9));
+}
@@ -0,0 +1,30 @@
+#ifndef __HISTORY_FLASH_H
+#define __HISTORY_FLASH_H
+
+#include "mcli.h"
+
+#include <stdint.h>
+
+// history_flash keeps command history in the HISTORY flash region reserved by STM32WL_FLASH.ld,
+// so it survives a reset or a reflash. Only one session can use it. Set it up once at startup:
+//   history_flash_load(cli_default_ctx());
+//   cli_set_history_save(history_flash_save);
+// then call history_flash_idle() from the superloop whenever there is nothing to process
+
+// this finds the history saved in flash and puts the newest entries back into ctx's history
+// it must be called before history_flash_save(), and before anything is entered
+void history_flash_load(mcli_ctx *ctx);
+// this adds cmd to the end of the log in flash. It matches mcli_history_save, so it
+// can be passed to cli_set_history_save() or used as a session's history_save
+// the core stalls while flash is written, and that takes well under 1 ms. It only erases a page
+// (about 20 ms) if history_flash_idle() hasn't already erased the one the log moves onto
+void history_flash_save(mcli_ctx *ctx, const char *cmd, uint32_t len);
+// this erases the page the log moves onto next, so history_flash_save() doesn't have to in the middle of a command.
+// it returns at once unless a page needs erasing, which happens once per page of commands saved.
+// note: the core stalls for about 20 ms while a page is erased, and no interrupts run, so whatever
+// arrives in that time has to fit in the receive buffer (main.c's 256-byte RX_DMA_BUFFER_SIZE fills in
+// about 22 ms at 115200 baud, and faster at higher rates). Anything more is lost.
+// so only call it when the line is idle, and an erase in history_flash_save() during a fast paste can lose input
+void history_flash_idle(void);
+
+#endif /* __HISTORY_FLASH_H */
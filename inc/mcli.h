@@ -1,10 +1,421 @@
 #ifndef __MCLI_H
 #define __MCLI_H
 
+#include "mcli_config.h"
+#include "mprintf.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// a command that returns MCLI_PENDING hasn't finished yet. It is called again (with the same
+// arguments) every time cli_process() runs, until it returns something else.
+// this lets a long command (a flash erase, a radio sweep) work in small steps while
+// characters keep being received. Ctrl-C cancels it: cli_cancelled() starts returning true,
+// and the command is called one last time to clean up.
+#define MCLI_PENDING      1
+
+// every CLI session keeps all of its state in an mcli_ctx
+typedef struct mcli_ctx mcli_ctx;
+
+// an mcli_notify function is called by cli_input() and cli_input_block() every time they
+// receive characters, so cli_process() only has to be called when there is work to do.
+// it runs in the producer's context (often an interrupt), so it should only signal, for example:
+//   static void cli_notify(mcli_ctx *ctx){ vTaskNotifyGiveFromISR(cliTask, NULL); }   // FreeRTOS
+//   static void cli_notify(mcli_ctx *ctx){ __SEV(); }                                  // bare metal, with __WFE()
+typedef void (*mcli_notify)(mcli_ctx *ctx);
+
+// an mcli_history_save function is called every time a new command is stored in history,
+// so it can be kept somewhere that survives a reset (see history_flash.h).
+// cmd is not '\0' terminated, and is only valid during the call
+typedef void (*mcli_history_save)(mcli_ctx *ctx, const char *cmd, uint32_t len);
+
+// MCLI_HELP() is how a command's help text is stored. With MCLI_HELP_TEXT turned off,
+// the text is left out of the build and every command's help is ""
+#if MCLI_HELP_TEXT
+#define MCLI_HELP(help)   help
+#else
+#define MCLI_HELP(help)   ""
+#endif
+
+typedef struct {
+  const char *const cmd_name;
+  int32_t (*func_pointer)(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+  const char *const help_text;
+  // raw_func is called when the command arrives in a binary frame (see MCLI_COMMAND_RAW() below)
+  int32_t (*raw_func)(mcli_ctx *ctx, const uint8_t *data, uint32_t len);
+} cmdEntry;
+
+// MCLI_COMMAND() registers a command from any source file, for example:
+//   static int32_t led_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+//   MCLI_COMMAND(led, led_cmd, "turns the LED on or off");
+// name is what gets typed, so it must also be a valid C identifier.
+// each entry is placed in its own ".mcli_cmd.<name>" section, and the linker script
+// gathers them into one table sorted by name. The table lives in flash, so it costs
+// no RAM and no startup time. Registering the same name twice fails to link.
+// the alignment is pinned so the compiler can't pad entries apart from each other.
+// the command table is shared by every session. ctx is the session that ran the command,
+// so commands should print with cli_puts()/cli_printf() and friends to answer the right terminal.
+#define MCLI_COMMAND(name, fn, help) \
+  const cmdEntry mcli_cmd_##name \
+  __attribute__((used, aligned(__alignof__(cmdEntry)), section(".mcli_cmd." #name))) = { \
+    .cmd_name = #name, \
+    .func_pointer = fn, \
+    .help_text = MCLI_HELP(help), \
+    .raw_func = NULL \
+  }
+
+// MCLI_COMMAND_RAW() registers a command that can also be run by a machine, with binary frames:
+//   static int32_t cal_raw(mcli_ctx *ctx, const uint8_t *data, uint32_t len);
+//   MCLI_COMMAND_RAW(cal, cal_cmd, cal_raw, "prints the calibration table");
+// fn runs when the command is typed, the same as with MCLI_COMMAND(), and can be NULL if it can't be.
+// raw_fn runs when the command arrives in a frame. It is given the frame's data,
+// answers with cli_frame_reply() (as many times as it needs to), and its result is sent back at the end.
+//
+// a frame starts with MCLI_FRAME_SYNC, which never appears in typed text (or UTF-8), at the start of a line.
+// everything is little-endian:
+//   MCLI_FRAME_SYNC, length (2 bytes), payload (length bytes), CRC (2 bytes)
+// the CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, starting at 0xFFFF) of the length and the payload.
+// a request's payload is the command name, a '\0', and then the data. It must fit in the command buffer
+// the first byte of every reply's payload says what it is:
+//   MCLI_FRAME_DATA, then what the command passed to cli_frame_reply()
+//   MCLI_FRAME_DONE, then the command's result (4 bytes). This is always the last reply
+//   MCLI_FRAME_ERROR, then one of the MCLI_FRAME_ERR_ codes below, if the command wasn't run at all
+// nothing is echoed while a frame is received. If a frame's bytes stop arriving part way, whatever is
+// sent next is taken as the rest of it, fails the CRC, and then gets treated as text. After an error,
+// a client should send Ctrl-C (0x03) to clear the line before its next frame
+#define MCLI_COMMAND_RAW(name, fn, raw_fn, help) \
+  const cmdEntry mcli_cmd_##name \
+  __attribute__((used, aligned(__alignof__(cmdEntry)), section(".mcli_cmd." #name))) = { \
+    .cmd_name = #name, \
+    .func_pointer = fn, \
+    .help_text = MCLI_HELP(help), \
+    .raw_func = raw_fn \
+  }
+
+#define MCLI_FRAME_SYNC         0xFE
+#define MCLI_FRAME_DATA         0x00
+#define MCLI_FRAME_DONE         0x01
+#define MCLI_FRAME_ERROR        0x02
+// the frame's CRC didn't match
+#define MCLI_FRAME_ERR_CRC      0x01
+// the frame didn't fit in the command buffer
+#define MCLI_FRAME_ERR_LENGTH   0x02
+// the payload has no '\0' after the command name
+#define MCLI_FRAME_ERR_FORMAT   0x03
+// no command has that name
+#define MCLI_FRAME_ERR_NOT_FOUND 0x04
+// the command has no raw_fn
+#define MCLI_FRAME_ERR_NOT_RAW  0x05
+
+/*** Session State ***/
+// the structures below are only public so sessions can be allocated statically.
+// don't modify them directly, use the functions at the bottom of this file.
+
+// ringBuf is a single-producer/single-consumer queue. The producer (cli_input) and the
+// consumer (cli_process) can run in different contexts without locking, because each
+// index and counter below is only ever written by one of them
+typedef struct {
+  // data points to the block of memory where data is stored
+  uint8_t *data;
+  // size is the maximum size the buffer can hold
+  uint32_t size;
+  // writeIndex is the location where the next data is written
+  // only the producer writes it
+  volatile uint32_t writeIndex;
+  // readIndex is the location where data should be read from
+  // only the consumer writes it
+  volatile uint32_t readIndex;
+  // overflowCount increments every time you try to push too much data into the buffer
+  // only the producer writes it
+  volatile uint32_t overflowCount;
+  // overflowHandled is the value of overflowCount the last time an overflow was handled
+  // only the consumer writes it
+  uint32_t overflowHandled;
+} ringBuf;
+
+typedef struct {
+  // data points to the block of memory where data is stored
+  char *data;
+  // size is the maximum size the buffer can hold
+  uint32_t size;
+  // len is the current length of the text in the buffer
+  uint32_t len;
+  // cursorOffset is how far the cursor is from the end of the entered text.
+  // 0 means the cursor is all the way to the right
+  uint32_t cursorOffset;
+} txtBuf;
+
+#if MCLI_STATS
+// call counts and cycle counts for one command
+typedef struct {
+  uint32_t calls;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+} cmdStats;
+
+// the counters each session keeps for the stats command
+typedef struct {
+  // the most characters rxBuffer has held at once, and how many characters have been received
+  // only the producer writes them
+  volatile uint32_t rxPeak;
+  volatile uint32_t bytesIn;
+  // how many characters have been printed, and how many history entries were freed to make room
+  uint32_t bytesOut;
+  uint32_t historyEvictions;
+  // how many cycles the running command has taken, over all of its steps so far
+  uint32_t cmdCycles;
+  // the totals for each command this session has run. entry i belongs to the i-th command in the (sorted) table,
+  // and commands past the first STATS_COMMANDS aren't counted
+  cmdStats commands[STATS_COMMANDS];
+  // the session's output. The session prints through a function that counts bytesOut and passes everything on to this
+  print_sink write;
+  void *write_ctx;
+} mcli_stats;
+#endif
+
+struct mcli_ctx {
+  // ring buffer to hold received characters until they are processed
+  ringBuf rxBuffer;
+  // cmdBuffer is where the current value of the command line is stored.
+  // as characters are typed or deleted, this buffer gets modified to match
+  // the displayed characters
+  txtBuf cmdBuffer;
+  // the 2 previously entered characters
+  char previous_char[2];
+  // echoing is put off until the end of each cli_process() pass (or until something else is printed),
+  // so a run of typed or pasted characters is redrawn all at once
+  // echoInsertLen is how many characters right before the cursor have been inserted but not echoed
+  uint32_t echoInsertLen;
+  // echoDeleteLen is how many backspaces haven't been echoed
+  uint32_t echoDeleteLen;
+
+#if MCLI_HISTORY
+  // history is a ring of entries packed one after another in historyData.
+  // each entry is a length byte followed by that many characters (no '\0'), and entries wrap
+  // around the end of historyData. Every entry is numbered in the order it was entered,
+  // and historyIndex[number % historyEntries] holds the offset of that entry
+  uint8_t *historyData;
+  uint32_t historyDataSize;
+  uint16_t *historyIndex;
+  uint32_t historyEntries;
+  // historyHead is the offset where the next entry goes, and historyUsed is how many bytes are in use
+  uint32_t historyHead;
+  uint32_t historyUsed;
+  // the number of the oldest entry still stored, and the number the next entry will get
+  // history is empty when they are the same
+  uint32_t historyOldest;
+  uint32_t historyNext;
+  // the number of the entry currently being shown. historyNext means none is
+  uint32_t historyView;
+  // Ctrl-R search state. searchMatch is the number of the entry found, historyNext means none was
+  bool searchMode;
+  char searchText[HISTORY_SEARCH_SIZE];
+  uint32_t searchLen;
+  uint32_t searchMatch;
+#endif
+
+  // the command that is currently running (or NULL), and the arguments it was given
+  // the arguments point into cmdBuffer, so it is left alone until the command finishes
+  const cmdEntry *runningCmd;
+  uint32_t argc;
+  char* argv[MAX_NUM_ARGS + 1];
+  // set when Ctrl-C is received while a command is running
+  bool cancelRequested;
+
+  // in batch mode, lines are run as they arrive without any echo, editing, prompts or history
+  bool batchMode;
+  // set when a batch line doesn't fit in cmdBuffer, so it is thrown away instead of run
+  bool batchLineTooLong;
+
+#if MCLI_FRAMES
+  // a binary frame is received into cmdBuffer. frameState is which part of the frame comes next
+  // (0 when no frame is being received), frameLen is the length of its payload, and
+  // frameCount is how much of the payload has been received
+  uint8_t frameState;
+  uint32_t frameLen;
+  uint32_t frameCount;
+  // the CRC of everything received so far, and the CRC the frame ends with
+  uint16_t frameCrc;
+  uint16_t frameRxCrc;
+#endif
+
+  // everything the session prints goes through write(write_ctx, ...)
+  print_sink write;
+  void *write_ctx;
+  // called whenever characters are received (can be NULL)
+  mcli_notify notify;
+  // called whenever a command is added to history (can be NULL)
+  mcli_history_save historySave;
+
+#if MCLI_STATS
+  mcli_stats stats;
+#endif
+};
+
+// mcli_screen keeps a shadow copy of the last frame a command drew with cli_screen_begin()/cli_screen_end()
+// the frame's top left corner is where the cursor was when the first frame started
+typedef struct {
+  // each row of shadow is 1 byte holding its length, then cols characters
+  char *shadow;
+  uint32_t rows;
+  uint32_t cols;
+  // how many rows the last frame had, and how many lines the terminal has from the top of the frame
+  // (including the one the cursor is on)
+  uint32_t usedRows;
+  uint32_t drawnRows;
+  // where the terminal's cursor is, and where the next character of the new frame goes
+  uint32_t termRow;
+  uint32_t termCol;
+  uint32_t row;
+  uint32_t col;
+  // the session's own output, which is put back by cli_screen_end()
+  print_sink write;
+  void *write_ctx;
+} mcli_screen;
+
+// the memory a session needs, all of it provided by the caller
+typedef struct {
+  // rx_buffer holds received characters until cli_process() gets to them
+  // rx_size must be a power of 2
+  char *rx_buffer;
+  uint32_t rx_size;
+  // cmd_buffer holds the line being typed. cmd_size sets the maximum line length (plus 1 for '\0')
+  char *cmd_buffer;
+  uint32_t cmd_size;
+  // history_buffer holds previously entered commands. It must be 2-byte aligned.
+  // up to history_entries commands are stored, as long as they fit. 2 bytes of history_buffer
+  // are used to index each entry, and the rest (up to 64 KiB) holds 1 byte + the length of each command.
+  // history_entries can be 0 to turn history off. All 3 are ignored when MCLI_HISTORY is 0
+  uint8_t *history_buffer;
+  uint32_t history_size;
+  uint32_t history_entries;
+  // write is called with everything the session prints, and is passed write_ctx
+  print_sink write;
+  void *write_ctx;
+  // notify is called every time characters are received. It can be NULL if cli_process() is polled
+  mcli_notify notify;
+  // history_save is called every time a command is added to history. It can be NULL
+  mcli_history_save history_save;
+} mcli_config;
+
+/*** Sessions ***/
+// set up ctx to use the memory and output in config
+// returns 0 if successful, or -1 if config isn't usable
+int32_t cli_init(mcli_ctx *ctx, const mcli_config *config);
+// these work the same as cli_input(), cli_input_block() and cli_process() below, but for the session ctx
+// every session is independent, so each one can be run from a different task
+void cli_ctx_input(mcli_ctx *ctx, char c);
+void cli_ctx_input_block(mcli_ctx *ctx, const char *data, uint32_t len);
+void cli_ctx_process(mcli_ctx *ctx);
+// returns true if cli_ctx_process() has work to do
+bool cli_ctx_pending(mcli_ctx *ctx);
+// returns true if Ctrl-C was pressed while the current command was running
+// a command that takes a while (or returns MCLI_PENDING) should check this and stop early
+bool cli_cancelled(mcli_ctx *ctx);
+// adds cmd (len characters, no '\0' needed) to the session's history without calling its history_save function
+// this is how saved history is put back after a reset. Entries are added oldest first
+void cli_ctx_history_load(mcli_ctx *ctx, const char *cmd, uint32_t len);
+
+// these print to the session ctx, the same way as their mprintf counterparts
+int32_t cli_write(mcli_ctx *ctx, const char *buf, uint32_t len);
+int32_t cli_puts(mcli_ctx *ctx, const char *str);
+int32_t cli_println(mcli_ctx *ctx, const char *str);
+int32_t cli_newline(mcli_ctx *ctx);
+int32_t cli_printf(mcli_ctx *ctx, const char * restrict format_str, ...);
+int32_t cli_printfln(mcli_ctx *ctx, const char * restrict format_str, ...);
+// the same, for a format declared with PRINTF_FORMAT() (see mprintf.h), which is only parsed once
+int32_t cli_printf_compiled(mcli_ctx *ctx, printf_format *format, ...);
+int32_t cli_printfln_compiled(mcli_ctx *ctx, printf_format *format, ...);
+// sends len bytes of data back to the client in one MCLI_FRAME_DATA reply
+// this should only be called by a command's raw_fn. len must be less than 65535
+// returns 0 if successful, or -1 if data is too long for a frame (or MCLI_FRAMES is 0)
+int32_t cli_frame_reply(mcli_ctx *ctx, const void *data, uint32_t len);
+
+/*** Screen Updates ***/
+// a command that redraws the same table over and over (a dashboard that returns MCLI_PENDING, for example)
+// can print each frame between cli_screen_begin() and cli_screen_end(). Instead of going straight out,
+// the frame is compared to the last one, and only the characters that changed are sent, along with
+// the cursor moves to get to them. For example:
+//   static char shadow[20 * (80 + 1)];
+//   static mcli_screen screen;
+//   cli_screen_init(&screen, shadow, sizeof(shadow), 80);     // when the command starts
+//   cli_screen_begin(ctx, &screen);
+//   cli_printfln(ctx, "temp: %4d", temp);                     // every refresh
+//   cli_screen_end(ctx, &screen);
+// rows end with '\n'. Anything past cols characters or the last row is dropped, and so are
+// control characters (like escape sequences). The whole frame must fit on the terminal.
+
+// set up screen to keep its shadow copy in buffer (buffer_size bytes). cols can be at most 255,
+// and each row takes cols + 1 bytes of buffer
+// the next frame is drawn in full, starting at the beginning of the line the cursor is on
+void cli_screen_init(mcli_screen *screen, char *buffer, uint32_t buffer_size, uint32_t cols);
+// everything ctx prints from here until cli_screen_end() becomes the next frame
+void cli_screen_begin(mcli_ctx *ctx, mcli_screen *screen);
+// sends what is left of the frame, and leaves the cursor at the beginning of the line below it
+void cli_screen_end(mcli_ctx *ctx, mcli_screen *screen);
+
+/*** Default Session ***/
+// the functions below use a built-in session that prints through write_()
+// a project with only one terminal doesn't need to call cli_init() at all
+
 // whenever a text character is received, call `cli_input()` and pass it the character
+// `cli_input()` and `cli_input_block()` can be called from an interrupt, as long as
+// they are only ever called from one context (they are the single producer)
 void cli_input(char c);
+// when several characters are received at once, call `cli_input_block()` and pass it all of them
+void cli_input_block(const char *data, uint32_t len);
 // put `cli_process()` somewhere in the superloop so it is called regularly
 // this processes incoming/outgoing text
 void cli_process(void);
+// returns true if `cli_process()` has work to do. To sleep until there is, check it with interrupts blocked:
+//   __disable_irq();
+//   if(!cli_pending()){
+//     __WFI();     // an interrupt that arrives now still wakes the core, it just runs after __enable_irq()
+//   }
+//   __enable_irq();
+bool cli_pending(void);
+// `notify` is called every time the default session receives characters or a log line (NULL turns it off)
+void cli_set_notify(mcli_notify notify);
+// `save` is called every time the default session adds a command to history (NULL turns it off)
+void cli_set_history_save(mcli_history_save save);
+// returns the default session, for functions that take an mcli_ctx (like history_flash_load())
+mcli_ctx *cli_default_ctx(void);
+
+/*** Log ***/
+// the log lets interrupts and other tasks print without waiting on the output, and without formatting
+// anything (or using much stack) where they are. Each line is copied into the log ring, and cli_process()
+// prints it on the default session later, above the line being typed, which is then drawn again.
+// lines wait while a command is running. Any number of interrupts and tasks can add lines at the same
+// time: the ring is lock-free, so no interrupts are ever blocked
+// both functions return 0 if the line was added, or -1 if it didn't fit (or MCLI_LOG is 0).
+// a line that doesn't fit is dropped, and the next flush says how many were
+
+// cli_log(format_str, ...) saves the format string pointer and up to 6 arguments, and formats them later
+// the format string (and any string printed with %s) must still be there when the line is printed,
+// so literals are best. Each argument is saved as one word: integers up to 32 bits, chars and pointers
+// work, but %f and 64-bit integers don't
+//   cli_log("adc overrun at %u", tick);
+#define cli_log(...)    MCLI_LOG_SELECT(__VA_ARGS__, MCLI_LOG_6, MCLI_LOG_5, MCLI_LOG_4, MCLI_LOG_3, \
+                                        MCLI_LOG_2, MCLI_LOG_1, MCLI_LOG_0, _)(__VA_ARGS__)
+// copies len characters of text that is already formatted (without a line ending)
+int32_t cli_log_write(const char *buf, uint32_t len);
+// what cli_log() calls. args holds num_args words
+int32_t cli_log_args(const char *format_str, uint32_t num_args, const uintptr_t *args);
+
+// cli_log() counts its arguments by picking one of these
+#define MCLI_LOG_SELECT(f, a1, a2, a3, a4, a5, a6, name, ...)    name
+#define MCLI_LOG_0(f)                       cli_log_args((f), 0, (const uintptr_t *)0)
+#define MCLI_LOG_1(f, a)                    cli_log_args((f), 1, (const uintptr_t[]){(uintptr_t)(a)})
+#define MCLI_LOG_2(f, a, b)                 cli_log_args((f), 2, (const uintptr_t[]){(uintptr_t)(a), (uintptr_t)(b)})
+#define MCLI_LOG_3(f, a, b, c)              cli_log_args((f), 3, (const uintptr_t[]){(uintptr_t)(a), (uintptr_t)(b), \
+                                                                                    (uintptr_t)(c)})
+#define MCLI_LOG_4(f, a, b, c, d)           cli_log_args((f), 4, (const uintptr_t[]){(uintptr_t)(a), (uintptr_t)(b), \
+                                                                                    (uintptr_t)(c), (uintptr_t)(d)})
+#define MCLI_LOG_5(f, a, b, c, d, e)        cli_log_args((f), 5, (const uintptr_t[]){(uintptr_t)(a), (uintptr_t)(b), \
+                                                                                    (uintptr_t)(c), (uintptr_t)(d), \
+                                                                                    (uintptr_t)(e)})
+#define MCLI_LOG_6(f, a, b, c, d, e, g)     cli_log_args((f), 6, (const uintptr_t[]){(uintptr_t)(a), (uintptr_t)(b), \
+                                                                                    (uintptr_t)(c), (uintptr_t)(d), \
+                                                                                    (uintptr_t)(e), (uintptr_t)(g)})
 
 #endif /* __MCLI_H */
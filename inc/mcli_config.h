@@ -0,0 +1,180 @@
+#ifndef __MCLI_CONFIG_H
+#define __MCLI_CONFIG_H
+
+// every compile-time setting of mcli and mprintf is here.
+// each one can be changed for the whole build by adding it to DEFINES in the Makefile,
+// for example MCLI_HISTORY=0 or RX_BUFFER_SIZE=64.
+// the feature switches are 1 to include a feature, or 0 to leave its code (and RAM) out altogether
+
+// MCLI_PROFILE_MINIMAL changes the defaults to the smallest CLI that can still run commands:
+// small buffers, no history, no line editing, no frames, no stats, no help text, no log, no %b or %f,
+// and compiled formats are parsed every time.
+// "make profile=minimal" defines it. Anything set explicitly still wins
+#ifdef MCLI_PROFILE_MINIMAL
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE    64
+#endif
+#ifndef CMD_BUFFER_SIZE
+#define CMD_BUFFER_SIZE   64
+#endif
+#ifndef MAX_NUM_ARGS
+#define MAX_NUM_ARGS      4
+#endif
+#ifndef MCLI_HISTORY
+#define MCLI_HISTORY      0
+#endif
+#ifndef MCLI_EDITING
+#define MCLI_EDITING      0
+#endif
+#ifndef MCLI_FRAMES
+#define MCLI_FRAMES       0
+#endif
+#ifndef MCLI_STATS
+#define MCLI_STATS        0
+#endif
+#ifndef MCLI_HELP_TEXT
+#define MCLI_HELP_TEXT    0
+#endif
+#ifndef MCLI_LOG
+#define MCLI_LOG          0
+#endif
+#ifndef PRINTF_STAGING_SIZE
+#define PRINTF_STAGING_SIZE   16
+#endif
+#ifndef PRINTF_BINARY
+#define PRINTF_BINARY     0
+#endif
+#ifndef PRINTF_FLOAT
+#define PRINTF_FLOAT      0
+#endif
+#ifndef PRINTF_COMPILED
+#define PRINTF_COMPILED   0
+#endif
+#endif /* MCLI_PROFILE_MINIMAL */
+
+/*** Buffers ***/
+// RX_BUFFER_SIZE is the size (in bytes) of the default session's input ring buffer.
+// This is where all characters are temporarily stored until they can be processed.
+// RX_BUFFER_SIZE must be a power of 2
+// this lets the read/write indices wrap much faster without using modulo
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE    128
+#endif
+// CMD_BUFFER_SIZE is the size (in bytes) of the default session's command buffer.
+// This is where the command line currently being typed is stored.
+// It also sets the maximum line length.
+// CMD_BUFFER_SIZE doesn't need to be a power of 2
+#ifndef CMD_BUFFER_SIZE
+#define CMD_BUFFER_SIZE   128
+#endif
+// MAX_NUM_ARGS is the maximum number of arguments allowed to be passed to a command
+// each one costs 4 bytes in every session, plus 8 bytes of stack while a line is parsed
+#ifndef MAX_NUM_ARGS
+#define MAX_NUM_ARGS      7
+#endif
+// HISTORY_SIZE is the size (in bytes) of the default session's history memory, including its index
+// HISTORY_SIZE and HISTORY_ENTRIES determine how many commands can be held in history before the oldest is freed
+#ifndef HISTORY_SIZE
+#define HISTORY_SIZE      1024
+#endif
+// HISTORY_ENTRIES is the maximum number of commands held in history. Each one takes 2 bytes of HISTORY_SIZE to index
+#ifndef HISTORY_ENTRIES
+#define HISTORY_ENTRIES   64
+#endif
+// HISTORY_SEARCH_SIZE is the size (in bytes) of the Ctrl-R search text, including the '\0'
+#ifndef HISTORY_SEARCH_SIZE
+#define HISTORY_SEARCH_SIZE   32
+#endif
+// LOG_BUFFER_SIZE is the size (in bytes) of the log ring that cli_log() lines wait in until cli_process() prints them
+// each line takes a word (4 bytes) for its header, and then its text, or 1 word for the format string and 1 per argument
+// LOG_BUFFER_SIZE must be a power of 2
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE   256
+#endif
+// STATS_COMMANDS is how many commands the stats command keeps call counts and cycle counts for.
+// each one costs 16 bytes in every session. Commands past the first STATS_COMMANDS in the (sorted) table aren't counted
+#ifndef STATS_COMMANDS
+#define STATS_COMMANDS    32
+#endif
+// printf_ staging buffer size. Formatted text is collected here and handed to write_()
+// every time it fills up, so this does not limit how long a printed string can be.
+// make it larger to call write_() less often, or smaller to decrease stack usage.
+#ifndef PRINTF_STAGING_SIZE
+#define PRINTF_STAGING_SIZE   32
+#endif
+// PRINTF_COMPILED_OPS is the most ops a compiled format (see PRINTF_FORMAT() in mprintf.h) can hold.
+// each conversion takes 1, and so does any text after the last one. Each op is 12 bytes of RAM
+// a format string that needs more is parsed on every use instead, so it still prints correctly
+#ifndef PRINTF_COMPILED_OPS
+#define PRINTF_COMPILED_OPS   8
+#endif
+
+/*** Features ***/
+// MCLI_HISTORY keeps entered commands, for the up/down arrow keys, the history command, !N and Ctrl-R
+#ifndef MCLI_HISTORY
+#define MCLI_HISTORY      1
+#endif
+// MCLI_EDITING lets the cursor move with the left/right arrow keys, so text can be inserted or deleted
+// mid-line, and completes command names with tab. Without it, characters are only added to and
+// backspaced from the end of the line, and other escape sequences are ignored
+#ifndef MCLI_EDITING
+#define MCLI_EDITING      1
+#endif
+// MCLI_FRAMES accepts binary frames (see MCLI_COMMAND_RAW() in mcli.h)
+#ifndef MCLI_FRAMES
+#define MCLI_FRAMES       1
+#endif
+// MCLI_STATS keeps the counters shown by the built-in stats command
+#ifndef MCLI_STATS
+#define MCLI_STATS        1
+#endif
+// MCLI_HELP_TEXT keeps every command's help text in flash. Without it, help only lists the command names
+#ifndef MCLI_HELP_TEXT
+#define MCLI_HELP_TEXT    1
+#endif
+// MCLI_LOG keeps the log ring, so interrupts and other tasks can print through cli_log() (see mcli.h)
+#ifndef MCLI_LOG
+#define MCLI_LOG          1
+#endif
+// PRINTF_BINARY supports the %b conversion in mprintf
+#ifndef PRINTF_BINARY
+#define PRINTF_BINARY     1
+#endif
+// PRINTF_FLOAT supports %f (double) and %q (fixed-point) in mprintf. Neither one uses any floating point math
+#ifndef PRINTF_FLOAT
+#define PRINTF_FLOAT      1
+#endif
+// PRINTF_COMPILED keeps the ops of every PRINTF_FORMAT(), so its format string is only parsed once.
+// without it, printf_compiled_() and friends still work, but parse the format string every time
+#ifndef PRINTF_COMPILED
+#define PRINTF_COMPILED   1
+#endif
+
+/*** Checks ***/
+_Static_assert((RX_BUFFER_SIZE >= 2) && ((RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) == 0),
+               "RX_BUFFER_SIZE must be a power of 2");
+// there has to be room for at least 1 character and the '\0'
+_Static_assert(CMD_BUFFER_SIZE >= 2, "CMD_BUFFER_SIZE is too small");
+_Static_assert(MAX_NUM_ARGS >= 1, "MAX_NUM_ARGS must be at least 1");
+#if MCLI_HISTORY
+// the index takes 2 bytes per entry, and the offsets it holds are 16 bits
+_Static_assert(HISTORY_ENTRIES >= 1, "HISTORY_ENTRIES must be at least 1");
+_Static_assert((HISTORY_SIZE > (HISTORY_ENTRIES * 2)) && ((HISTORY_SIZE - (HISTORY_ENTRIES * 2)) <= 0x10000),
+               "HISTORY_SIZE must be bigger than its index, and hold at most 64 KiB of entries");
+_Static_assert(HISTORY_SEARCH_SIZE >= 2, "HISTORY_SEARCH_SIZE is too small");
+#endif
+#if MCLI_LOG
+// the ring is indexed by word (a pointer's size), so the number of words has to be a power of 2
+_Static_assert((LOG_BUFFER_SIZE >= (4 * sizeof(void *))) && ((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0),
+               "LOG_BUFFER_SIZE must be a power of 2, and hold at least 4 words");
+#endif
+#if MCLI_STATS
+_Static_assert(STATS_COMMANDS >= 1, "STATS_COMMANDS must be at least 1");
+#endif
+_Static_assert(PRINTF_STAGING_SIZE >= 1, "PRINTF_STAGING_SIZE must be at least 1");
+#if PRINTF_COMPILED
+// the op count is kept in 8 bits, and 255 marks a format that didn't fit
+_Static_assert((PRINTF_COMPILED_OPS >= 1) && (PRINTF_COMPILED_OPS < 255), "PRINTF_COMPILED_OPS must be from 1 to 254");
+#endif
+
+#endif /* __MCLI_CONFIG_H */
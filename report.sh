@@ -0,0 +1,108 @@
+#!/bin/bash
+
+# this bash script is called by "make report"
+# usage: report.sh <version> <probe> <name>:<elf>:<map> ...
+# it prints a JSON summary of every build it is given: the flash (.text) and RAM (.data, .bss)
+# used by the whole image and by each mcli module, and the cycles from reset to the cli being ready.
+# the cycles can only be measured on the target, so they are null unless probe is 1.
+# then each image is loaded through the same probe that debug.sh uses, run until the
+# superloop starts, and bootCycles (see src/main.c) is read back
+
+set -e
+
+SIZE=${SIZE:-arm-none-eabi-size}
+GDB=${GDB:-gdb-multiarch}
+PROBE_PORT=${PROBE_PORT:-/dev/ttyACM0}
+
+# the objects that make up mcli (including the flash history log), in the order they are reported
+MODULES="mcli.o mprintf.o history_flash.o mmemcpy.o mmemmove.o mmemset.o mstrcmp.o mstrlen.o"
+
+version=$1
+probe=$2
+shift 2
+
+# prints "<module> <text> <data> <bss>" for each module, from the sections the linker kept.
+# .data is counted in RAM here, even though its initial values also take the same amount of flash
+module_sizes() {
+    awk -v modules="$MODULES" '
+        BEGIN { n = split(modules, list, " ") }
+        # everything above this line is the list of discarded sections
+        /^Linker script and memory map/ { started = 1; next }
+        !started { next }
+        # output sections start in the first column
+        /^\.[^ ]/ {
+            if ($1 == ".data") { kind = "data" }
+            else if ($1 == ".bss") { kind = "bss" }
+            else if ($1 ~ /^\.(isr_vector|text|rodata|mcli_cmd|ARM)/) { kind = "text" }
+            else { kind = "" }
+            pending = 0
+            next
+        }
+        # input sections are indented by 1 space, and a long name pushes the rest onto the next line
+        /^ [.A-Z]/ && $1 != "*fill*" {
+            if (NF >= 4 && $2 ~ /^0x/ && $3 ~ /^0x/) { add($3, $4) } else if (NF == 1) { pending = 1 }
+            next
+        }
+        pending && NF >= 3 && $1 ~ /^0x/ && $2 ~ /^0x/ { add($2, $3) }
+        { pending = 0 }
+        function add(size, file,    base) {
+            pending = 0
+            if (kind == "") { return }
+            base = file
+            sub(/.*\//, "", base)
+            total[base, kind] += hex(size)
+        }
+        # plain awk has no strtonum(), so the "0x..." sizes are converted by hand
+        function hex(str,    value, i) {
+            value = 0
+            str = tolower(substr(str, 3))
+            for (i = 1; i <= length(str); i++) { value = value * 16 + index("0123456789abcdef", substr(str, i, 1)) - 1 }
+            return value
+        }
+        END {
+            for (i = 1; i <= n; i++) {
+                m = list[i]
+                printf "%s %d %d %d\n", m, total[m, "text"], total[m, "data"], total[m, "bss"]
+            }
+        }
+    ' "$1"
+}
+
+# prints bootCycles from the image running on the target
+boot_cycles() {
+    "$GDB" -batch -ex "set confirm off" \
+        -ex "target extended-remote $PROBE_PORT" -ex "monitor swd_scan" \
+        -ex "attach 1" -ex "load" -ex "break cli_process" -ex "run" \
+        -ex "print/u bootCycles" -ex "kill" \
+        "$1" 2>/dev/null | sed -n 's/^\$[0-9]* = \([0-9]*\)$/\1/p' | tail -n 1
+}
+
+echo "{"
+echo "  \"version\": \"$version\","
+echo "  \"builds\": {"
+first_build=1
+for build in "$@"; do
+    IFS=: read -r name elf map <<< "$build"
+    [ $first_build -eq 1 ] || echo "    },"
+    first_build=0
+
+    read -r text data bss _ <<< "$("$SIZE" "$elf" | awk 'NR == 2')"
+    cycles=null
+    if [ "$probe" = "1" ]; then
+        cycles=$(boot_cycles "$elf")
+        cycles=${cycles:-null}
+    fi
+
+    echo "    \"$name\": {"
+    echo "      \"total\": { \"text\": $text, \"data\": $data, \"bss\": $bss },"
+    echo "      \"boot_cycles\": $cycles,"
+    echo "      \"modules\": {"
+    module_sizes "$map" | awk '
+        { line[NR] = sprintf("        \"%s\": { \"text\": %d, \"data\": %d, \"bss\": %d }", $1, $2, $3, $4) }
+        END { for (i = 1; i <= NR; i++) { print line[i] (i < NR ? "," : "") } }
+    '
+    echo "      }"
+done
+[ $first_build -eq 1 ] || echo "    }"
+echo "  }"
+echo "}"
@@ -0,0 +1,364 @@
+#include "history_flash.h"
+#include "mcli.h"
+#include "utils.h"
+
+#include "stm32wlxx.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// there is nothing to keep without history
+#if MCLI_HISTORY
+
+// the history log is a ring of flash pages. Each page in use starts with a header, and then
+// records are appended one after another. When a page fills up, the log moves on to the next
+// page (wrapping around the end of the region). That page is erased ahead of time by
+// history_flash_idle(), so the 20 ms erase doesn't land in the middle of a command.
+// so every page is erased once per trip around the region, the oldest records are the
+// ones that get erased, and one page is always kept blank.
+
+// HISTORY_PAGE_SIZE is the size (in bytes) of a flash page, the smallest area that can be erased
+#define HISTORY_PAGE_SIZE     2048
+// every page in use starts with HISTORY_PAGE_MAGIC ("MCLH")
+#define HISTORY_PAGE_MAGIC    0x484C434DUL
+// every record starts with HISTORY_RECORD_MARK, then 1 byte of length, then the characters (no '\0')
+// reading stops at the first record that doesn't start with it, like the erased (0xFF) end of a page
+#define HISTORY_RECORD_MARK   0xA5
+#define HISTORY_RECORD_HEADER 2
+// flash is programmed a double word (8 bytes) at a time, so records are padded with 0xFF to a multiple of 8
+#define FLASH_DWORD_SIZE      8
+// the size of the biggest record, which holds a command of HISTORY_MAX_LEN characters
+#define HISTORY_MAX_LEN       UINT8_MAX
+#define HISTORY_RECORD_MAX    ((HISTORY_RECORD_HEADER + HISTORY_MAX_LEN + FLASH_DWORD_SIZE - 1) & ~(FLASH_DWORD_SIZE - 1))
+
+// writing these keys to FLASH->KEYR unlocks FLASH->CR
+#define FLASH_KEY1            0x45670123UL
+#define FLASH_KEY2            0xCDEF89ABUL
+// every error the flash can report. Writing 1 clears them
+#define FLASH_SR_ERRORS       (FLASH_SR_OPERR | FLASH_SR_PROGERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | \
+                               FLASH_SR_SIZERR | FLASH_SR_PGSERR | FLASH_SR_MISERR | FLASH_SR_FASTERR | \
+                               FLASH_SR_RDERR | FLASH_SR_OPTVERR)
+
+typedef struct {
+  uint32_t magic;
+  // sequence goes up by 1 every time a page is started, so the newest page has the highest one
+  uint32_t sequence;
+} pageHeader;
+
+static uint32_t page_count(void);
+static const uint8_t *page_address(uint32_t page);
+static bool page_sequence(uint32_t page, uint32_t *sequence);
+static uint32_t walk_page(uint32_t page, mcli_ctx *ctx, uint32_t skip, uint32_t *end);
+static int32_t start_page(void);
+static inline uint32_t record_size(uint32_t len);
+static bool is_erased(const uint8_t *address, uint32_t size);
+
+static int32_t flash_program(const uint8_t *address, const void *data, uint32_t size);
+static int32_t flash_erase(const uint8_t *address);
+static int32_t flash_wait(void);
+static void flash_unlock(void);
+static void flash_lock(void);
+static void flash_flush_caches(void);
+
+// the HISTORY region in STM32WL_FLASH.ld
+extern const uint8_t __history_flash_start[];
+extern const uint8_t __history_flash_end[];
+
+// the page the next record goes in, and its sequence number
+static uint32_t writePage;
+static uint32_t writeSequence;
+// where the next record goes in writePage. HISTORY_PAGE_SIZE means a new page has to be started first
+static uint32_t writeOffset = HISTORY_PAGE_SIZE;
+// nothing is written until history_flash_load() has found the end of the log
+static bool logReady = false;
+// true once the page after writePage is known to be blank
+static bool nextPageErased = false;
+
+
+/*** Function Definitions ***/
+// this function finds the newest page of the log, then walks the pages from oldest to newest.
+// only the record headers are read to count the records, then the newest ones are loaded
+// straight out of flash into ctx's history. So nothing is copied into RAM that history
+// doesn't keep, and the time taken is bounded by the size of the region
+void history_flash_load(mcli_ctx *ctx)
+{
+  uint32_t pages = page_count();
+  uint32_t newest = 0;
+  uint32_t newest_sequence = 0;
+  bool found = false;
+  for(uint32_t page = 0; page < pages; page++){
+    uint32_t sequence;
+    if(page_sequence(page, &sequence) && (!found || (sequence > newest_sequence))){
+      newest = page;
+      newest_sequence = sequence;
+      found = true;
+    }
+  }
+
+  logReady = true;
+  if(!found){
+    // the region is blank, so the first record starts page 0 with sequence 0
+    writePage = pages - 1;
+    writeSequence = UINT32_MAX;
+    writeOffset = HISTORY_PAGE_SIZE;
+    return;
+  }
+
+  // pages are filled in order, so the oldest page still in the log comes right after the newest one,
+  // and page (newest + 1 + i) should have sequence (newest_sequence - (pages - 1 - i)).
+  // a page that doesn't (like one that was never used) isn't part of the log
+  uint32_t total = 0;
+  uint32_t end = sizeof(pageHeader);
+  for(uint32_t i = 0; i < pages; i++){
+    uint32_t page = (newest + 1 + i) % pages;
+    uint32_t sequence;
+    if(page_sequence(page, &sequence) && (sequence == (newest_sequence - (pages - 1 - i)))){
+      total += walk_page(page, NULL, 0, &end);
+    }
+  }
+
+  // history can't hold more than historyEntries, so skip the older records
+  uint32_t skip = (total > ctx->historyEntries) ? (total - ctx->historyEntries) : 0;
+  for(uint32_t i = 0; i < pages; i++){
+    uint32_t page = (newest + 1 + i) % pages;
+    uint32_t sequence;
+    if(page_sequence(page, &sequence) && (sequence == (newest_sequence - (pages - 1 - i)))){
+      uint32_t count = walk_page(page, ctx, skip, &end);
+      skip = (skip > count) ? (skip - count) : 0;
+    }
+  }
+
+  // the newest page is walked last, so end is where its records stop
+  writePage = newest;
+  writeSequence = newest_sequence;
+  writeOffset = end;
+}
+
+// this function appends cmd to the log, starting a new page if it doesn't fit in the current one
+void history_flash_save(mcli_ctx *ctx, const char *cmd, uint32_t len)
+{
+  (void)ctx;
+  if((!logReady) || (len > HISTORY_MAX_LEN)){
+    return;
+  }
+
+  // build the whole record first, so it can be programmed a double word at a time
+  uint32_t record[HISTORY_RECORD_MAX / sizeof(uint32_t)];
+  uint8_t *bytes = (uint8_t *)record;
+  uint32_t size = record_size(len);
+  bytes[0] = HISTORY_RECORD_MARK;
+  bytes[1] = (uint8_t)len;
+  memcpy_(&bytes[HISTORY_RECORD_HEADER], cmd, len);
+  for(uint32_t i = HISTORY_RECORD_HEADER + len; i < size; i++){
+    bytes[i] = 0xFF;
+  }
+
+  // a reset in the middle of a write can leave the end of the page unusable, so check it is still blank
+  if(((writeOffset + size) > HISTORY_PAGE_SIZE) ||
+     (!is_erased(page_address(writePage) + writeOffset, size))){
+    if(start_page() < 0){
+      return;
+    }
+  }
+  if(flash_program(page_address(writePage) + writeOffset, record, size) < 0){
+    // the log stops at a bad record, so nothing else can go in this page
+    writeOffset = HISTORY_PAGE_SIZE;
+    return;
+  }
+  writeOffset += size;
+}
+
+// this function erases the page the log moves onto next, if it isn't already blank
+// it does nothing once that page is ready, so it can be called on every pass of the superloop
+void history_flash_idle(void)
+{
+  if((!logReady) || nextPageErased){
+    return;
+  }
+  const uint8_t *address = page_address((writePage + 1) % page_count());
+  if(!is_erased(address, HISTORY_PAGE_SIZE)){
+    // if this fails, start_page() tries again when the page is needed
+    flash_erase(address);
+  }
+  nextPageErased = true;
+}
+
+// returns the number of pages in the HISTORY region
+static uint32_t page_count(void)
+{
+  return ((uint32_t)(__history_flash_end - __history_flash_start) / HISTORY_PAGE_SIZE);
+}
+
+static const uint8_t *page_address(uint32_t page)
+{
+  return (__history_flash_start + (page * HISTORY_PAGE_SIZE));
+}
+
+// this function checks whether page has a header
+// returns true if it does, and sets sequence to the page's sequence number
+static bool page_sequence(uint32_t page, uint32_t *sequence)
+{
+  const pageHeader *header = (const pageHeader *)page_address(page);
+  if(header->magic != HISTORY_PAGE_MAGIC){
+    return (false);
+  }
+  *sequence = header->sequence;
+  return (true);
+}
+
+// this function steps through the records in page, and loads every one after the first skip into ctx
+// ctx can be NULL to only count them
+// returns the number of records in page, and sets end to the offset right after the last one
+static uint32_t walk_page(uint32_t page, mcli_ctx *ctx, uint32_t skip, uint32_t *end)
+{
+  const uint8_t *base = page_address(page);
+  uint32_t offset = sizeof(pageHeader);
+  uint32_t count = 0;
+  while(((offset + HISTORY_RECORD_HEADER) <= HISTORY_PAGE_SIZE) && (base[offset] == HISTORY_RECORD_MARK)){
+    uint32_t len = base[offset + 1];
+    uint32_t size = record_size(len);
+    if((offset + size) > HISTORY_PAGE_SIZE){
+      break;
+    }
+    if((ctx != NULL) && (count >= skip)){
+      cli_ctx_history_load(ctx, (const char *)&base[offset + HISTORY_RECORD_HEADER], len);
+    }
+    count++;
+    offset += size;
+  }
+  *end = offset;
+  return (count);
+}
+
+// this function moves the log onto the next page. The page is only erased if it isn't already blank,
+// which only happens here if history_flash_idle() didn't get to it first
+// returns 0 if successful, or -1 if the flash couldn't be erased or programmed
+static int32_t start_page(void)
+{
+  uint32_t page = (writePage + 1) % page_count();
+  const uint8_t *address = page_address(page);
+  if(!is_erased(address, HISTORY_PAGE_SIZE)){
+    CHECK(flash_erase(address));
+  }
+  pageHeader header = {
+    .magic = HISTORY_PAGE_MAGIC,
+    .sequence = writeSequence + 1
+  };
+  CHECK(flash_program(address, &header, sizeof(header)));
+
+  writePage = page;
+  writeSequence++;
+  writeOffset = sizeof(header);
+  // the page after this one still holds old records until history_flash_idle() erases it
+  nextPageErased = false;
+  return (0);
+}
+
+// returns the size a record holding a command of len characters takes up in flash
+static inline uint32_t record_size(uint32_t len)
+{
+  return ((HISTORY_RECORD_HEADER + len + FLASH_DWORD_SIZE - 1) & ~(FLASH_DWORD_SIZE - 1));
+}
+
+// returns true if none of the size bytes at address have been programmed since the last erase
+// address and size must be multiples of 4
+static bool is_erased(const uint8_t *address, uint32_t size)
+{
+  const uint32_t *words = (const uint32_t *)address;
+  for(uint32_t i = 0; i < (size / sizeof(uint32_t)); i++){
+    if(words[i] != UINT32_MAX){
+      return (false);
+    }
+  }
+  return (true);
+}
+
+/***** Flash Functions *****/
+// this function programs size bytes of data into flash at address, a double word at a time
+// address must be a multiple of 8, size must be a multiple of 8, and data must be 4-byte aligned
+// returns 0 if successful, or -1 if the flash reported an error
+static int32_t flash_program(const uint8_t *address, const void *data, uint32_t size)
+{
+  volatile uint32_t *dest = (volatile uint32_t *)address;
+  const uint32_t *src = (const uint32_t *)data;
+  int32_t result = 0;
+
+  flash_unlock();
+  for(uint32_t i = 0; i < (size / sizeof(uint32_t)); i += 2){
+    result = flash_wait();
+    if(result < 0){
+      break;
+    }
+    FLASH->CR |= FLASH_CR_PG;
+    // programming starts once the second word of the double word is written
+    dest[i] = src[i];
+    __ISB();
+    dest[i + 1] = src[i + 1];
+    result = flash_wait();
+    FLASH->CR &= ~FLASH_CR_PG;
+    if(result < 0){
+      break;
+    }
+  }
+  flash_lock();
+  return (result);
+}
+
+// this function erases the flash page at address
+// returns 0 if successful, or -1 if the flash reported an error
+static int32_t flash_erase(const uint8_t *address)
+{
+  uint32_t page = ((uintptr_t)address - FLASH_BASE) / HISTORY_PAGE_SIZE;
+  int32_t result;
+
+  flash_unlock();
+  result = flash_wait();
+  if(result == 0){
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PNB_Msk) | (page << FLASH_CR_PNB_Pos) | FLASH_CR_PER;
+    FLASH->CR |= FLASH_CR_STRT;
+    result = flash_wait();
+    FLASH->CR &= ~(FLASH_CR_PER | FLASH_CR_PNB_Msk);
+  }
+  flash_lock();
+  // the caches could still be holding what was in the page before it was erased
+  flash_flush_caches();
+  return (result);
+}
+
+// this function waits for the current flash operation to finish, then checks for errors
+// any errors are cleared, so the next operation can start
+// returns 0 if there weren't any, otherwise -1
+static int32_t flash_wait(void)
+{
+  while(FLASH->SR & (FLASH_SR_BSY | FLASH_SR_CFGBSY)){}
+  uint32_t errors = FLASH->SR & FLASH_SR_ERRORS;
+  if(errors != 0){
+    FLASH->SR = errors;
+    return (-1);
+  }
+  return (0);
+}
+
+static void flash_unlock(void)
+{
+  if(FLASH->CR & FLASH_CR_LOCK){
+    FLASH->KEYR = FLASH_KEY1;
+    FLASH->KEYR = FLASH_KEY2;
+  }
+}
+
+static void flash_lock(void)
+{
+  FLASH->CR |= FLASH_CR_LOCK;
+}
+
+// the caches have to be turned off while they are reset
+static void flash_flush_caches(void)
+{
+  uint32_t acr = FLASH->ACR;
+  FLASH->ACR = acr & ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+  FLASH->ACR = (acr & ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN)) | FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+  FLASH->ACR = acr & ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+}
+
+#endif /* MCLI_HISTORY */
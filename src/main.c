@@ -1,9 +1,12 @@
 #include "mprintf.h"
 #include "mcli.h"
+#include "history_flash.h"
+#include "utils.h"
 
 #include "stm32wlxx.h"
 
 #include "stm32wlxx_ll_bus.h"
+#include "stm32wlxx_ll_dma.h"
 #include "stm32wlxx_ll_rcc.h"
 #include "stm32wlxx_ll_gpio.h"
 #include "stm32wlxx_ll_lpuart.h"
@@ -12,40 +15,233 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// TX_BUFFER_SIZE is the size (in bytes) of the output ring buffer.
+// characters passed to putchar_() or write_() wait here until the LPUART interrupt sends them.
+// TX_BUFFER_SIZE must be a power of 2
+#define TX_BUFFER_SIZE    512
+
+// RX_DMA_BUFFER_SIZE is the size (in bytes) of the circular buffer the DMA fills with received characters.
+// received characters are handed to cli_input_block() when the line goes idle and every time
+// the DMA reaches the middle or the end of this buffer, so it only has to hold half a burst.
+#define RX_DMA_BUFFER_SIZE  256
+
+// UART_BAUD_RATE can be raised as high as 921600 as long as the LPUART clock is at least 3x faster
+#define UART_BAUD_RATE    115200
+
+// these are the policies write_() can follow when the TX ring buffer is full
+// TX_FULL_BLOCK waits until the interrupt makes room, so no characters are lost
+#define TX_FULL_BLOCK     0
+// TX_FULL_DROP discards any character that doesn't fit
+#define TX_FULL_DROP      1
+// TX_FULL_TRUNCATE discards the rest of the line once a character doesn't fit,
+// then waits for room to send the '\n' so the following lines stay intact
+#define TX_FULL_TRUNCATE  2
+// TX_FULL_POLICY selects which policy write_() uses
+// note: TX_FULL_BLOCK will hang if write_() is called with the LPUART interrupt blocked
+#define TX_FULL_POLICY    TX_FULL_BLOCK
+
+// HISTORY_FLASH keeps command history in the HISTORY flash region (see src/history_flash.c),
+// so it survives a reset or a reflash. Set it to 0 to keep history in RAM only
+// it is always off when history is compiled out (see MCLI_HISTORY in mcli_config.h)
+#define HISTORY_FLASH     MCLI_HISTORY
+
+typedef struct {
+  // data points to the block of memory where data is stored
+  uint8_t *data;
+  // size is the maximum size the buffer can hold
+  uint32_t size;
+  // writeIndex is the location where the next data is written
+  // it is only modified by write_()
+  volatile uint32_t writeIndex;
+  // readIndex is the location where data should be read from
+  // it is only modified by the LPUART interrupt
+  volatile uint32_t readIndex;
+} txRingBuf;
+
 static void UART_init(void);
+static void UART_RX_DMA_init(void);
+static void rx_dma_drain(void);
 static void sysclk_init(void);
 static void Error_Handler(void);
 
+static uint32_t bufWrite(txRingBuf *buf, const uint8_t *data, uint32_t len);
+
+// ring buffer to hold characters until the LPUART interrupt transmits them
+static txRingBuf txBuffer = {
+  .data = (uint8_t[TX_BUFFER_SIZE]){},
+  .size = TX_BUFFER_SIZE,
+  .writeIndex = 0,
+  .readIndex = 0
+};
+
+// the DMA writes received characters here, wrapping around when it reaches the end
+static char rxDmaBuffer[RX_DMA_BUFFER_SIZE];
+// rxDmaReadPos is the location of the next character that hasn't been passed to the cli yet
+static uint32_t rxDmaReadPos = 0;
+
+#if TX_FULL_POLICY == TX_FULL_TRUNCATE
+// true while the rest of a line is being discarded
+static bool txTruncating = false;
+#endif
+
 extern uint32_t _vector_table_offset;
 
+// bootCycles is how many cycles it took from reset until the cli was ready for its first character
+// the DWT cycle counter is started by Reset_Handler, so this includes setting up .data and .bss.
+// "make report probe=1" reads it with the debugger
+volatile uint32_t bootCycles = 0;
+
 int main(void)
 {
   SCB->VTOR = (uint32_t)(&_vector_table_offset);  // set the vector table offset
   sysclk_init();
   UART_init();
+  UART_RX_DMA_init();
+
+#if HISTORY_FLASH
+  // put back the history from before the reset, then log every new command
+  history_flash_load(cli_default_ctx());
+  cli_set_history_save(history_flash_save);
+#endif
+
+  bootCycles = DWT->CYCCNT;
 
   while (1)
   {
-    // if UART data is present, receive it
-    if(LL_LPUART_IsActiveFlag_RXNE_RXFNE(LPUART1)){
-      char c = (char)LL_LPUART_ReceiveData8(LPUART1);
-      cli_input(c);
-    }
-  	// LL_mDelay(1000);
+    // received characters are passed to the cli by the DMA and LPUART interrupts
     cli_process();
 
+#if HISTORY_FLASH
+    // with nothing left to process, erase the history log's next page now,
+    // instead of in the middle of a command (see history_flash.h)
+    if(!cli_pending()){
+      history_flash_idle();
+    }
+#endif
+
+    // sleep until the next interrupt, unless one already handed over more characters.
+    // interrupts are blocked while checking, so one can't slip in between the check and __WFI().
+    // a pending interrupt still wakes the core from __WFI(), and then runs after __enable_irq().
+    // this is Sleep mode, so the LPUART, DMA and TX interrupt keep running
+    __disable_irq();
+    if(!cli_pending()){
+      __WFI();
+    }
+    __enable_irq();
   }
 }
 
+// queue a single character to be sent by the LPUART interrupt
+// returns the character if it was queued, otherwise -1
 int32_t putchar_(char c)
 {
-  // loop while the LPUART_TDR register is full
-  while(LL_LPUART_IsActiveFlag_TXE_TXFNF(LPUART1) != 1);
-  // once the LPUART_TDR register is empty, fill it with char c
-  LL_LPUART_TransmitData8(LPUART1, (uint8_t)c);
+  if(write_(&c, 1) != 1){
+    return (-1);
+  }
   return (c);
 }
 
+// queue a span of characters to be sent by the LPUART interrupt
+// what happens when txBuffer is full depends on TX_FULL_POLICY
+// returns the number of characters queued
+int32_t write_(const char *buf, uint32_t len)
+{
+  const uint8_t *data = (const uint8_t *)buf;
+  int32_t queued = 0;
+
+  while(len > 0){
+#if TX_FULL_POLICY == TX_FULL_TRUNCATE
+    if(txTruncating){
+      // discard characters until the end of the line
+      while((len > 0) && (*data != '\n')){
+        data++;
+        len--;
+      }
+      if(len == 0){
+        break;
+      }
+      txTruncating = false;
+    }
+#endif
+    uint32_t copied = bufWrite(&txBuffer, data, len);
+    // the interrupt fires as soon as the LPUART_TDR register is empty
+    // it disables itself again once txBuffer runs out of characters
+    LL_LPUART_EnableIT_TXE_TXFNF(LPUART1);
+    data += copied;
+    len -= copied;
+    queued += copied;
+
+    if(copied == 0){
+#if TX_FULL_POLICY == TX_FULL_DROP
+      break;
+#elif TX_FULL_POLICY == TX_FULL_TRUNCATE
+      // the '\n' is always sent, but anything else starts discarding the line
+      if(*data != '\n'){
+        txTruncating = true;
+      }
+#endif
+      // otherwise, loop and wait for the interrupt to make room
+    }
+  }
+  return (queued);
+}
+
+// the LPUART interrupt moves characters from txBuffer to the LPUART_TDR register
+// it also passes received characters to the cli once the RX line goes idle
+void LPUART1_IRQHandler(void)
+{
+  if(LL_LPUART_IsEnabledIT_IDLE(LPUART1) && LL_LPUART_IsActiveFlag_IDLE(LPUART1)){
+    LL_LPUART_ClearFlag_IDLE(LPUART1);
+    rx_dma_drain();
+  }
+
+  if(LL_LPUART_IsEnabledIT_TXE_TXFNF(LPUART1) && LL_LPUART_IsActiveFlag_TXE_TXFNF(LPUART1)){
+    uint32_t readIndex = txBuffer.readIndex;
+    if(readIndex != txBuffer.writeIndex){
+      LL_LPUART_TransmitData8(LPUART1, txBuffer.data[readIndex]);
+      // assuming the buffer size is a power of 2,
+      // modulus isn't needed to wrap the index
+      txBuffer.readIndex = (readIndex + 1) & (txBuffer.size - 1);
+    }else{
+      // nothing left to send, stop interrupting until write_() queues more
+      LL_LPUART_DisableIT_TXE_TXFNF(LPUART1);
+    }
+  }
+}
+
+// the DMA interrupt passes received characters to the cli every time the DMA
+// fills half of rxDmaBuffer, so a long burst is handed over before it can wrap around
+void DMA1_Channel1_IRQHandler(void)
+{
+  if(LL_DMA_IsActiveFlag_HT1(DMA1)){
+    LL_DMA_ClearFlag_HT1(DMA1);
+  }
+  if(LL_DMA_IsActiveFlag_TC1(DMA1)){
+    LL_DMA_ClearFlag_TC1(DMA1);
+  }
+  rx_dma_drain();
+}
+
+// pass every character the DMA has written since the last call to the cli
+// this is only called from interrupts that share the same priority, so it can't interrupt itself
+static void rx_dma_drain(void)
+{
+  // the DMA counts down how many characters are left until it wraps around
+  uint32_t write_pos = RX_DMA_BUFFER_SIZE - LL_DMA_GetDataLength(DMA1, LL_DMA_CHANNEL_1);
+  if(write_pos >= RX_DMA_BUFFER_SIZE){
+    write_pos = 0;
+  }
+
+  if(write_pos > rxDmaReadPos){
+    cli_input_block(&rxDmaBuffer[rxDmaReadPos], write_pos - rxDmaReadPos);
+  }else if(write_pos < rxDmaReadPos){
+    // the new characters wrap around the end of rxDmaBuffer
+    cli_input_block(&rxDmaBuffer[rxDmaReadPos], RX_DMA_BUFFER_SIZE - rxDmaReadPos);
+    cli_input_block(rxDmaBuffer, write_pos);
+  }
+  rxDmaReadPos = write_pos;
+}
+
 static void sysclk_init(void)
 {
   // update the global variable SystemCoreClock
@@ -81,10 +277,10 @@ static void UART_init(void)
   LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
 
   // configure the LPUART to transmit with the following settings:
-  // baud = 115200, data bits = 8, stop bits = 1, parity bits = 0
+  // baud = UART_BAUD_RATE, data bits = 8, stop bits = 1, parity bits = 0
   LL_LPUART_InitTypeDef LPUART_InitStruct = {
       .PrescalerValue = LL_LPUART_PRESCALER_DIV1,
-      .BaudRate = 115200,
+      .BaudRate = UART_BAUD_RATE,
       .DataWidth = LL_LPUART_DATAWIDTH_8B,
       .StopBits = LL_LPUART_STOPBITS_1,
       .Parity = LL_LPUART_PARITY_NONE,
@@ -96,8 +292,50 @@ static void UART_init(void)
 
   // wait for the LPUART module to send an idle frame and finish initialization
   while(!(LL_LPUART_IsActiveFlag_TEACK(LPUART1)) || !(LL_LPUART_IsActiveFlag_REACK(LPUART1)));
+
+  // the TXE interrupt itself is enabled by write_() whenever there is data to send
+  NVIC_SetPriority(LPUART1_IRQn, 0);
+  NVIC_EnableIRQ(LPUART1_IRQn);
 }
 
+// configure DMA1 channel 1 to copy every received character into rxDmaBuffer
+static void UART_RX_DMA_init(void)
+{
+  // enable the DMA and DMAMUX clocks
+  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMAMUX1);
+  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_DMA1);
+
+  // route the LPUART1 RX request to channel 1, and have it copy bytes from the
+  // LPUART_RDR register into rxDmaBuffer, starting over when it reaches the end
+  LL_DMA_SetPeriphRequest(DMA1, LL_DMA_CHANNEL_1, LL_DMAMUX_REQ_LPUART1_RX);
+  LL_DMA_ConfigTransfer(DMA1, LL_DMA_CHANNEL_1,
+                        LL_DMA_DIRECTION_PERIPH_TO_MEMORY |
+                        LL_DMA_MODE_CIRCULAR |
+                        LL_DMA_PERIPH_NOINCREMENT |
+                        LL_DMA_MEMORY_INCREMENT |
+                        LL_DMA_PDATAALIGN_BYTE |
+                        LL_DMA_MDATAALIGN_BYTE |
+                        LL_DMA_PRIORITY_HIGH);
+  LL_DMA_ConfigAddresses(DMA1, LL_DMA_CHANNEL_1,
+                         LL_LPUART_DMA_GetRegAddr(LPUART1, LL_LPUART_DMA_REG_DATA_RECEIVE),
+                         (uint32_t)rxDmaBuffer, LL_DMA_DIRECTION_PERIPH_TO_MEMORY);
+  LL_DMA_SetDataLength(DMA1, LL_DMA_CHANNEL_1, RX_DMA_BUFFER_SIZE);
+
+  // interrupt when the DMA reaches the middle and the end of rxDmaBuffer
+  LL_DMA_EnableIT_HT(DMA1, LL_DMA_CHANNEL_1);
+  LL_DMA_EnableIT_TC(DMA1, LL_DMA_CHANNEL_1);
+  LL_DMA_EnableChannel(DMA1, LL_DMA_CHANNEL_1);
+
+  // the DMA interrupt must have the same priority as the LPUART interrupt
+  // so the two can't interrupt each other while calling rx_dma_drain()
+  NVIC_SetPriority(DMA1_Channel1_IRQn, 0);
+  NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+  // start the transfers, and interrupt whenever the RX line goes idle after a burst of characters
+  LL_LPUART_ClearFlag_IDLE(LPUART1);
+  LL_LPUART_EnableIT_IDLE(LPUART1);
+  LL_LPUART_EnableDMAReq_RX(LPUART1);
+}
 
 static void Error_Handler(void)
 {
@@ -121,3 +359,28 @@ void assert_failed(uint8_t *file, uint32_t line)
      ex: printf("Wrong parameters value: file %s on line %d\r\n", file, line) */
 }
 #endif /* USE_FULL_ASSERT */
+
+// this function copies as much of data into a ring buffer as will fit
+// it returns the number of bytes copied
+static uint32_t bufWrite(txRingBuf *buf, const uint8_t *data, uint32_t len)
+{
+  uint32_t writeIndex = buf->writeIndex;
+  // one slot is always left empty so a full buffer can be told apart from an empty one
+  uint32_t space = (buf->readIndex - writeIndex - 1) & (buf->size - 1);
+  if(len > space){
+    len = space;
+  }
+  // the data may have to wrap around the end of the buffer
+  uint32_t first_len = buf->size - writeIndex;
+  if(first_len > len){
+    first_len = len;
+  }
+  memcpy_(&buf->data[writeIndex], data, first_len);
+  memcpy_(buf->data, &data[first_len], len - first_len);
+  // make sure the data lands in memory before the interrupt can see the new write index
+  __DMB();
+  // assuming the buffer size is a power of 2,
+  // modulus isn't needed to wrap the index
+  buf->writeIndex = (writeIndex + len) & (buf->size - 1);
+  return (len);
+}
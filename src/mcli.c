@@ -5,325 +5,1032 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-
-// RX_BUFFER_SIZE is the size (in bytes) of the input ring buffer.
-// This is where all characters are temporarily stored until they can be processed.
-// RX_BUFFER_SIZE must be a power of 2
-// this lets the read/write indices wrap much faster without using modulo
-#define RX_BUFFER_SIZE    128
-// CMD_BUFFER_SIZE is the size (in bytes) of the command buffer.
-// This is where the command line currently being typed is stored.
-// It also sets the maximum line length.
-// CMD_BUFFER_SIZE doesn't need to be a power of 2
-#define CMD_BUFFER_SIZE   128
-// MAX_NUM_ARGS is the maximum number of arguments allowed to be passed to a command
-#define MAX_NUM_ARGS      7
-// HISTORY_SIZE must be a multiple of 4
-// HISTORY_SIZE determines how many commands can be held in history before the oldest is freed
-#define HISTORY_SIZE      1024
-
-
-/*** Internal Structures ***/
-typedef struct {
-  // data points to the block of memory where data is stored
-  uint8_t *data;
-  // size is the maximum size the buffer can hold
-  uint32_t size;
-  // writeIndex is the location where the next data is written
-  uint32_t writeIndex;
-  // readIndex is the location where data should be read from
-  uint32_t readIndex;
-  // overflow is true when you try to push too much data into the buffer
-  bool overflow;
-} ringBuf;
-
+#include <stdarg.h>
+
+// BATCH_EXIT_CHAR ends batch mode. 0x04 is what Ctrl-D sends
+#define BATCH_EXIT_CHAR   0x04
+// CANCEL_CHAR cancels the running command, or clears the line. 0x03 is what Ctrl-C sends
+#define CANCEL_CHAR       0x03
+// SEARCH_CHAR starts a reverse search through history. 0x12 is what Ctrl-R sends
+#define SEARCH_CHAR       0x12
+
+// MEMORY_BARRIER() makes sure every memory access before it has completed before any memory access after it.
+// the ring buffer uses it so cli_input() can be called from an interrupt while cli_process() runs in the superloop
+#if defined(__ARM_ARCH)
+#define MEMORY_BARRIER()  __asm volatile ("dmb" ::: "memory")
+#else
+#define MEMORY_BARRIER()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#if MCLI_STATS
+// commands are timed with the DWT cycle counter. Cores without one (and the host build) count 0 cycles
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define STATS_DEMCR       (*(volatile uint32_t *)0xE000EDFCUL)
+#define STATS_DWT_CTRL    (*(volatile uint32_t *)0xE0001000UL)
+#define STATS_DWT_CYCCNT  (*(volatile uint32_t *)0xE0001004UL)
+#define STATS_DEMCR_TRCENA      (1UL << 24)
+#define STATS_DWT_CYCCNTENA     (1UL << 0)
+#endif
+#endif
+
+// the tokenizer reads the command line a word (4 bytes) at a time where it can.
+// SWAR_SPACES is a word of 4 spaces (and so on), and swar_has_zero() checks all 4 bytes of a word for 0 at once
+#define SWAR_ONES         0x01010101UL
+#define SWAR_HIGHS        0x80808080UL
+#define SWAR_SPACES       0x20202020UL
+#define SWAR_QUOTES       0x22222222UL
+#define SWAR_BACKSLASHES  0x5C5C5C5CUL
+// the command line is a char array, so words are read through a type that may alias it
+typedef uint32_t __attribute__((may_alias)) aliasWord;
+
+// the parts of a binary frame, in the order they are received
+#define FRAME_IDLE        0
+#define FRAME_LEN_LOW     1
+#define FRAME_LEN_HIGH    2
+#define FRAME_PAYLOAD     3
+#define FRAME_CRC_LOW     4
+#define FRAME_CRC_HIGH    5
+// frames are checked with CRC-16/CCITT-FALSE
+#define FRAME_CRC_INIT    0xFFFF
+#define FRAME_CRC_POLY    0x1021
+
+#if MCLI_LOG
+// the log ring is made of words the size of a pointer, so a format string pointer fits in one
+#define LOG_WORD_SIZE     sizeof(uintptr_t)
+#define LOG_WORDS         (LOG_BUFFER_SIZE / LOG_WORD_SIZE)
+// the most arguments a cli_log() line can have (as many as MCLI_LOG_SELECT() can count)
+#define LOG_MAX_ARGS      6
+// every line in the log starts with a header word. It is written last, with LOG_READY set, so the
+// consumer knows the rest of the line is there. The low bits are how many characters of text follow,
+// or (with LOG_FORMAT) how many arguments follow the format string pointer
+#define LOG_READY         ((uintptr_t)1 << 31)
+#define LOG_FORMAT        ((uintptr_t)1 << 30)
+#define LOG_LEN_MASK      0xFFFFUL
+#endif
+
+// when only a few unchanged characters sit between two changed ones in a screen update,
+// they are sent again instead of moving the cursor over them, since the move takes as many bytes
+#define SCREEN_REWRITE_GAP  4
+
+// the errors tokenize_command() can return
+#define TOKENIZE_TOO_MANY_ARGS  (-1)
+#define TOKENIZE_OPEN_QUOTE     (-2)
+
+// tokenEnd is where a word of the command line ends, and whether it has quotes or escapes
+// that have to be taken out before the command sees it
 typedef struct {
-  // data points to the block of memory where data is stored
-  char *data;
-  // size is the maximum size the buffer can hold
-  uint32_t size;
-  // len is the current length of the text in the buffer
-  uint32_t len;
-  // cursorOffset is how far the cursor is from the end of the entered text.
-  // 0 means the cursor is all the way to the right
-  uint32_t cursorOffset;
-} txtBuf;
-
-typedef struct cmd_hist {
-  // cmd_len is the length of string cmd
-  uint32_t cmd_len;
-  // prev points to the previous (newer) command in the linked list
-  struct cmd_hist *prev;
-  // next points to the next (older) command in the linked list
-  struct cmd_hist *next;
-  // cmd is variable length string. This is the first character.
-  char cmd;
-} cmdHistory;
+  char *end;
+  bool escaped;
+} tokenEnd;
 
-typedef struct {
-  const char *const cmd_name;
-  int32_t (*func_pointer)(uint32_t argc, char* argv[]);
-  const char *const help_text;
-} cmdEntry;
 
 /*** Internal Function Definitions ***/
-static int32_t parse_command(void);
-static int32_t tokenize_command(char* cmd_buffer, uint32_t* argc, char* argv[]);
-
-static void handle_escape_char(char c);
-static void handle_printable_char(char c);
-static void handle_control_char(char c);
+static int32_t parse_command(mcli_ctx *ctx, bool keep_history);
+static int32_t run_command(mcli_ctx *ctx);
+static void check_cancel(mcli_ctx *ctx);
+static void finish_cmd_line(mcli_ctx *ctx);
+static const cmdEntry* find_command(const char *cmd_name);
+#if MCLI_EDITING
+static void complete_command(mcli_ctx *ctx);
+static const cmdEntry* find_first_prefix_match(const char *prefix, uint32_t prefix_len);
+static uint32_t prefix_match_len(const char *str1, const char *str2, uint32_t max_len);
+#endif
+static int32_t tokenize_command(char* cmd_buffer, uint32_t len, uint32_t* argc, char* argv[], tokenEnd ends[]);
+static void terminate_tokens(uint32_t argc, char* argv[], tokenEnd ends[]);
+static uint32_t skip_spaces(const char *str, uint32_t i, uint32_t len);
+static int32_t scan_word(const char *str, uint32_t i, uint32_t len, tokenEnd *end);
+static inline uint32_t swar_has_zero(uint32_t word);
+#ifdef DEBUG
+static void check_command_table(mcli_ctx *ctx);
+#endif
+
+static void handle_escape_char(mcli_ctx *ctx, char c);
+static void handle_printable_char(mcli_ctx *ctx, char c);
+static void handle_control_char(mcli_ctx *ctx, char c);
+static void handle_batch_char(mcli_ctx *ctx, char c);
+#if MCLI_FRAMES
+static inline bool frame_can_start(mcli_ctx *ctx, char c);
+static void handle_frame_char(mcli_ctx *ctx, uint8_t c);
+static void run_frame(mcli_ctx *ctx);
+static int32_t send_frame(mcli_ctx *ctx, uint8_t kind, const void *data, uint32_t len);
+static uint16_t crc16_update(uint16_t crc, const void *data, uint32_t len);
+#endif
+
+static int32_t screen_write(void *write_ctx, const char *buf, uint32_t len);
+static void screen_char(mcli_screen *screen, char c);
+static void screen_end_row(mcli_screen *screen);
+static void screen_move(mcli_screen *screen, uint32_t row, uint32_t col);
+static void screen_esc_seq(mcli_screen *screen, uint32_t n, char cmd);
+static inline char *screen_row(mcli_screen *screen, uint32_t row);
+static void flush_echo(mcli_ctx *ctx);
+static void print_esc_seq(mcli_ctx *ctx, uint32_t n, char cmd);
 
 static inline bool isPrintableChar(char c);
-static inline bool isBlank(txtBuf *buf);
-static inline void reset_cmdBuffer(void);
-static inline void print_prompt(void);
-static void clear_cmd_line(bool show_prompt);
-
-static void history_display(cmdHistory *hist_cmd);
-static void history_input(txtBuf *cmd);
-static void* history_malloc(uint32_t byte_request);
-static void free_oldest_cmd(void);
+static inline void reset_cmdBuffer(mcli_ctx *ctx);
+static inline void print_prompt(mcli_ctx *ctx);
+#if MCLI_HISTORY || MCLI_LOG
+static void clear_cmd_line(mcli_ctx *ctx, bool show_prompt);
+#endif
+
+#if MCLI_HISTORY
+static void history_display(mcli_ctx *ctx, uint32_t number);
+static void history_input(mcli_ctx *ctx, const char *cmd, uint32_t len);
+static bool history_store(mcli_ctx *ctx, const char *cmd, uint32_t len);
+static uint32_t history_copy(mcli_ctx *ctx, uint32_t number, char *dest, uint32_t dest_size);
+static void history_write(mcli_ctx *ctx, uint32_t number);
+static bool history_matches(mcli_ctx *ctx, uint32_t number, const char *str, uint32_t len, bool substring);
+static void free_oldest_cmd(mcli_ctx *ctx);
+static int32_t history_expand(mcli_ctx *ctx);
+
+static bool handle_search_char(mcli_ctx *ctx, char c);
+static void search_history(mcli_ctx *ctx, uint32_t start);
+static void search_display(mcli_ctx *ctx);
+static void search_finish(mcli_ctx *ctx, bool keep_match);
+#endif
+
+#if MCLI_LOG
+static int32_t log_reserve(uint32_t num_words, uint32_t *start);
+static void log_commit(uint32_t start, uintptr_t header);
+static void log_drop(void);
+static bool log_ready(mcli_ctx *ctx);
+static void log_flush(mcli_ctx *ctx);
+static uint32_t log_print_line(mcli_ctx *ctx, uint32_t start, uintptr_t header);
+static void redraw_cmd_line(mcli_ctx *ctx);
+#endif
 
 static uint8_t bufPop(ringBuf *buf);
 static int32_t bufPush(ringBuf *buf, uint8_t value);
+static uint32_t bufPushBlock(ringBuf *buf, const uint8_t *data, uint32_t len);
 static bool bufIsEmpty(ringBuf *buf);
+static bool bufDiscardThrough(ringBuf *buf, uint8_t value);
 
-/*** External Functions ***/
-// this function is called to output a single character over UART
-extern int32_t putchar_(char c);
+static int32_t default_write(void *write_ctx, const char *buf, uint32_t len);
+
+#if MCLI_STATS
+static int32_t stats_write(void *write_ctx, const char *buf, uint32_t len);
+static void stats_rx(mcli_ctx *ctx, uint32_t len);
+static void stats_command(mcli_ctx *ctx, const cmdEntry *cmd);
+static inline uint32_t cycle_count(void);
+#endif
 
 /*** Command Table Function Declarations ***/
-static int32_t help_cmd(uint32_t argc, char* argv[]);
-// declare more command functions here. Functions must have the form:
-// int32_t func_name(uint32_t argc, char*argv[]);
+static int32_t help_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+#if MCLI_FRAMES
+static int32_t help_raw(mcli_ctx *ctx, const uint8_t *data, uint32_t len);
+#endif
+static int32_t batch_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+#if MCLI_HISTORY
+static int32_t history_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+#endif
+#if MCLI_STATS
+static int32_t stats_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[]);
+#endif
 
 
 /*** Internal Variables and Structures ***/
-// cmd_table is where command names (what is typed) get mapped
-// to function pointers (which function gets called)
-static const cmdEntry cmd_table[] =
-{
-  {
-    .cmd_name = "help",
-    .func_pointer = help_cmd,
-    .help_text = "displays list of builtin commands"
+// the built-in commands are registered the same way as any other command
+#if MCLI_FRAMES
+MCLI_COMMAND_RAW(help, help_cmd, help_raw, "displays list of builtin commands");
+#else
+MCLI_COMMAND(help, help_cmd, "displays list of builtin commands");
+#endif
+MCLI_COMMAND(batch, batch_cmd, "runs lines without echo or prompts until Ctrl-D");
+#if MCLI_HISTORY
+MCLI_COMMAND(history, history_cmd, "lists previous commands. !N runs number N again");
+#endif
+#if MCLI_STATS
+MCLI_COMMAND(stats, stats_cmd, "shows buffer use, byte counts and command timings");
+#endif
+#if MCLI_LOG
+// the log ring. Any number of producers add lines, and only the default session's cli_process() takes them out
+typedef struct {
+  uintptr_t words[LOG_WORDS];
+  // both indices count words, and are only wrapped when a word is accessed
+  // reserveIndex is where the next line goes. Producers claim space by moving it with a compare-and-swap
+  uint32_t reserveIndex;
+  // readIndex is the first word that hasn't been printed. Only the consumer writes it
+  volatile uint32_t readIndex;
+  // how many lines didn't fit, and the value it had the last time that was reported
+  uint32_t dropped;
+  uint32_t droppedHandled;
+} logRing;
+#endif
+
+// every MCLI_COMMAND() entry is placed between these two symbols by the linker script,
+// sorted by name. This is the command table.
+extern const cmdEntry __mcli_cmd_start[];
+extern const cmdEntry __mcli_cmd_end[];
+
+// memory for the default session
+static uint8_t defaultRxMemory[RX_BUFFER_SIZE];
+static char defaultCmdMemory[CMD_BUFFER_SIZE];
+#if MCLI_HISTORY
+static uint16_t defaultHistoryIndex[HISTORY_ENTRIES];
+static uint8_t defaultHistoryData[HISTORY_SIZE - sizeof(defaultHistoryIndex)];
+#endif
+
+// the session used by cli_input(), cli_input_block() and cli_process()
+// it prints through write_()
+static mcli_ctx defaultCtx = {
+  .rxBuffer = {
+    .data = defaultRxMemory,
+    .size = RX_BUFFER_SIZE
+  },
+  .cmdBuffer = {
+    .data = defaultCmdMemory,
+    .size = CMD_BUFFER_SIZE
+  },
+#if MCLI_HISTORY
+  .historyData = defaultHistoryData,
+  .historyDataSize = sizeof(defaultHistoryData),
+  .historyIndex = defaultHistoryIndex,
+  .historyEntries = HISTORY_ENTRIES,
+#endif
+#if MCLI_STATS
+  .write = stats_write,
+  .write_ctx = &defaultCtx,
+  .stats = {
+    .write = default_write,
+    .write_ctx = NULL
   }
-  // after declaring a new command function above, add an entry for it in this table
-};
-
-// ring buffer to hold received characters until they are processed
-static ringBuf rxBuffer = {
-  .data = (uint8_t[RX_BUFFER_SIZE]){},
-  .size = RX_BUFFER_SIZE,
-  .writeIndex = 0,
-  .readIndex = 0,
-  .overflow = false
-};
-
-// cmdBuffer is where the current value of the command line is stored.
-// as characters are typed or deleted, this buffer gets modified to match
-// the displayed characters
-static txtBuf cmdBuffer = {
-  .data = (char[CMD_BUFFER_SIZE]){0},
-  .size = CMD_BUFFER_SIZE,
-  .len = 0,
-  .cursorOffset = 0
+#else
+  .write = default_write,
+  .write_ctx = NULL
+#endif
 };
 
-// the 2 previously entered characters
-static char previous_char[2] = {0};
+#if MCLI_LOG
+// lines waiting to be printed on the default session
+static logRing logBuffer;
+#endif
 
-// newest command stored in history
-static cmdHistory *newest_cmd = NULL;
-// oldest command stored in history
-static cmdHistory *oldest_cmd = NULL;
-// history command currently being shown
-static cmdHistory *current_history_cmd = NULL;
 
 
 /*** Function Definitions ***/
+// this function sets up a new session in ctx, using the memory and output given in config
+// returns 0 if successful, or -1 if config isn't usable
+int32_t cli_init(mcli_ctx *ctx, const mcli_config *config)
+{
+  // the ring buffer needs a power of 2 size, and the command buffer needs room for at least the '\0'
+  if((config->rx_size < 2) || (config->rx_size & (config->rx_size - 1)) ||
+     (config->cmd_size < 1) || (config->write == NULL)){
+    return (-1);
+  }
+#if MCLI_HISTORY
+  // the history index is made of 2-byte offsets taken from the start of the history memory,
+  // so the rest has to fit in 64 KiB
+  uint32_t index_size = config->history_entries * sizeof(uint16_t);
+  uint32_t data_size = config->history_size - index_size;
+  if((config->history_entries > 0) &&
+     (((uintptr_t)config->history_buffer & 0x01) || (config->history_size <= index_size) || (data_size > 0x10000))){
+    return (-1);
+  }
+#endif
+
+  *ctx = (mcli_ctx){
+    .rxBuffer = {
+      .data = (uint8_t *)config->rx_buffer,
+      .size = config->rx_size
+    },
+    .cmdBuffer = {
+      .data = config->cmd_buffer,
+      .size = config->cmd_size
+    },
+#if MCLI_HISTORY
+    .historyData = config->history_buffer + index_size,
+    .historyDataSize = (config->history_entries > 0) ? data_size : 0,
+    .historyIndex = (uint16_t *)config->history_buffer,
+    .historyEntries = config->history_entries,
+#endif
+    .write = config->write,
+    .write_ctx = config->write_ctx,
+    .notify = config->notify,
+    .historySave = config->history_save
+  };
+#if MCLI_STATS
+  // the session prints through stats_write(), which counts the bytes and passes them on
+  ctx->stats.write = config->write;
+  ctx->stats.write_ctx = config->write_ctx;
+  ctx->write = stats_write;
+  ctx->write_ctx = ctx;
+#endif
+  reset_cmdBuffer(ctx);
+  return (0);
+}
+
 // this function must be called every time a charcter is received
 // it pushes the character into a ring buffer for later processing
-void cli_input(char c)
+void cli_ctx_input(mcli_ctx *ctx, char c)
 {
-  int32_t result = bufPush(&rxBuffer, (uint8_t)c);
+  int32_t result = bufPush(&ctx->rxBuffer, (uint8_t)c);
   if(result < 0){
-    rxBuffer.overflow = true;
+    ctx->rxBuffer.overflowCount++;
+  }
+#if MCLI_STATS
+  // a character that didn't fit is only counted as an overflow
+  stats_rx(ctx, (result < 0) ? 0 : 1);
+#endif
+  // an overflow is work for cli_process() too, so notify either way
+  if(ctx->notify != NULL){
+    ctx->notify(ctx);
+  }
+}
+
+// this function can be called instead of cli_ctx_input() when several characters
+// are received at once (for example, by a DMA transfer)
+// it pushes all the characters into the ring buffer in one go
+void cli_ctx_input_block(mcli_ctx *ctx, const char *data, uint32_t len)
+{
+  uint32_t pushed = bufPushBlock(&ctx->rxBuffer, (const uint8_t *)data, len);
+  if(pushed < len){
+    ctx->rxBuffer.overflowCount++;
+  }
+#if MCLI_STATS
+  stats_rx(ctx, pushed);
+#endif
+  if((len > 0) && (ctx->notify != NULL)){
+    ctx->notify(ctx);
   }
 }
 
 // this function is called in the superloop. It checks for characters in the 
 // ring buffer and processes them accordingly
-void cli_process(void)
+void cli_ctx_process(mcli_ctx *ctx)
 {
-  while(!bufIsEmpty(&rxBuffer)){
-    char c = (char)bufPop(&rxBuffer);
-
-    // check for escape sequence
-    if((previous_char[0] == 0x1B) && (c == '[')){
-      // avoid printing '['. This is technically a printable character, 
-      // but in this context it's an escape code
-    }else if((previous_char[0] == '[') && (previous_char[1] == 0x1B)){
-      handle_escape_char(c);
-    }else if(isPrintableChar(c)){
-      handle_printable_char(c);
+  // a pending command gets to run another step before any new input is handled
+  if(ctx->runningCmd != NULL){
+    check_cancel(ctx);
+    run_command(ctx);
+    if(ctx->runningCmd != NULL){
+      // still running. Everything typed in the meantime waits in the ring buffer
+      return;
+    }
+    finish_cmd_line(ctx);
+  }
+
+  while(!bufIsEmpty(&ctx->rxBuffer)){
+    char c = (char)bufPop(&ctx->rxBuffer);
+
+#if MCLI_FRAMES
+    // a binary frame can start at the beginning of any line, and takes every byte until it ends
+    // (a frame's command runs to completion, so it can't leave a pending command behind)
+    if((ctx->frameState != FRAME_IDLE) || frame_can_start(ctx, c)){
+      flush_echo(ctx);
+      handle_frame_char(ctx, (uint8_t)c);
+      continue;
+    }
+#endif
+    // batch mode skips all of the interactive handling below
+    if(ctx->batchMode){
+      handle_batch_char(ctx, c);
     }else{
-      handle_control_char(c);
+      // check for escape sequence
+#if MCLI_HISTORY
+      if(ctx->searchMode && handle_search_char(ctx, c)){
+        // the character was part of a history search
+      }else
+#endif
+      if((ctx->previous_char[0] == 0x1B) && (c == '[')){
+        // avoid printing '['. This is technically a printable character, 
+        // but in this context it's an escape code
+      }else if((ctx->previous_char[0] == '[') && (ctx->previous_char[1] == 0x1B)){
+        flush_echo(ctx);
+        handle_escape_char(ctx, c);
+      }else if(isPrintableChar(c)){
+        handle_printable_char(ctx, c);
+      }else{
+        // backspaces are echoed in a batch too, anything else may print
+        if((c != '\b') && (c != 0x7F)){
+          flush_echo(ctx);
+        }
+        handle_control_char(ctx, c);
+      }
+
+      // record previous 2 characters
+      ctx->previous_char[1] = ctx->previous_char[0];
+      ctx->previous_char[0] = c;
     }
 
-    // record previous 2 characters
-    previous_char[1] = previous_char[0];
-    previous_char[0] = c;
+    // if that started a pending command, the rest of the input waits until it finishes
+    if(ctx->runningCmd != NULL){
+      return;
+    }
+  }
+  // catch the terminal up with everything typed during this pass
+  flush_echo(ctx);
+
+  // the producer may overflow again while this is handled, so only mark
+  // the overflows that were seen as handled
+  uint32_t overflowCount = ctx->rxBuffer.overflowCount;
+  if(overflowCount != ctx->rxBuffer.overflowHandled){
+    // handle overflow by erasing the current command (or frame)
+    cli_newline(ctx);
+    cli_println(ctx, "ERROR: ring buffer overflowed");
+    reset_cmdBuffer(ctx);
+#if MCLI_FRAMES
+    ctx->frameState = FRAME_IDLE;
+#endif
+    ctx->rxBuffer.overflowHandled = overflowCount;
+  }
+}
+
+// this function returns true if there are received characters (or an overflow)
+// that cli_ctx_process() hasn't handled yet
+bool cli_ctx_pending(mcli_ctx *ctx)
+{
+  return ((ctx->runningCmd != NULL) || (!bufIsEmpty(&ctx->rxBuffer)) ||
+          (ctx->rxBuffer.overflowCount != ctx->rxBuffer.overflowHandled));
+}
+
+// this function returns true if the running command has been cancelled with Ctrl-C
+// it should only be called by commands (from the same context as cli_ctx_process())
+bool cli_cancelled(mcli_ctx *ctx)
+{
+  check_cancel(ctx);
+  return (ctx->cancelRequested);
+}
+
+// this function puts a saved command back into history, without saving it again
+void cli_ctx_history_load(mcli_ctx *ctx, const char *cmd, uint32_t len)
+{
+#if MCLI_HISTORY
+  history_store(ctx, cmd, len);
+#else
+  (void)ctx;
+  (void)cmd;
+  (void)len;
+#endif
+}
+
+void cli_input(char c)
+{
+  cli_ctx_input(&defaultCtx, c);
+}
+
+void cli_input_block(const char *data, uint32_t len)
+{
+  cli_ctx_input_block(&defaultCtx, data, len);
+}
+
+void cli_process(void)
+{
+  cli_ctx_process(&defaultCtx);
+#if MCLI_LOG
+  log_flush(&defaultCtx);
+#endif
+}
+
+bool cli_pending(void)
+{
+#if MCLI_LOG
+  if(log_ready(&defaultCtx)){
+    return (true);
+  }
+#endif
+  return (cli_ctx_pending(&defaultCtx));
+}
+
+// the notify function is read by the producer, so set it before characters can arrive
+void cli_set_notify(mcli_notify notify)
+{
+  defaultCtx.notify = notify;
+}
+
+void cli_set_history_save(mcli_history_save save)
+{
+  defaultCtx.historySave = save;
+}
+
+mcli_ctx *cli_default_ctx(void)
+{
+  return (&defaultCtx);
+}
+
+// this function adds a line of text to the log. It can be called from anywhere, even several places at once
+int32_t cli_log_write(const char *buf, uint32_t len)
+{
+#if MCLI_LOG
+  // a line can't be longer than the whole ring
+  if(len >= LOG_BUFFER_SIZE){
+    log_drop();
+    return (-1);
+  }
+  uint32_t start;
+  CHECK(log_reserve(1 + ((len + LOG_WORD_SIZE - 1) / LOG_WORD_SIZE), &start));
+
+  // the text goes right after the header, and may wrap around the end of the ring
+  uint8_t *bytes = (uint8_t *)logBuffer.words;
+  uint32_t offset = ((start + 1) & (LOG_WORDS - 1)) * LOG_WORD_SIZE;
+  uint32_t first_len = sizeof(logBuffer.words) - offset;
+  if(first_len > len){
+    first_len = len;
+  }
+  memcpy_(&bytes[offset], buf, first_len);
+  memcpy_(bytes, &buf[first_len], len - first_len);
+  log_commit(start, len);
+  return (0);
+#else
+  (void)buf;
+  (void)len;
+  return (-1);
+#endif
+}
+
+// this function adds a line to the log that is formatted when it is printed
+// It can be called from anywhere, even several places at once
+int32_t cli_log_args(const char *format_str, uint32_t num_args, const uintptr_t *args)
+{
+#if MCLI_LOG
+  if(num_args > LOG_MAX_ARGS){
+    log_drop();
+    return (-1);
   }
+  uint32_t start;
+  CHECK(log_reserve(2 + num_args, &start));
 
-  if(rxBuffer.overflow){
-    // handle overflow by erasing the current command
-    print_newline();
-    println_("ERROR: ring buffer overflowed");
-    reset_cmdBuffer();
-    rxBuffer.overflow = false;
+  logBuffer.words[(start + 1) & (LOG_WORDS - 1)] = (uintptr_t)format_str;
+  for(uint32_t i = 0; i < num_args; i++){
+    logBuffer.words[(start + 2 + i) & (LOG_WORDS - 1)] = args[i];
   }
+  log_commit(start, LOG_FORMAT | num_args);
+  return (0);
+#else
+  (void)format_str;
+  (void)num_args;
+  (void)args;
+  return (-1);
+#endif
+}
+
+/***** Output Functions *****/
+// everything a session prints goes through its write callback
+int32_t cli_write(mcli_ctx *ctx, const char *buf, uint32_t len)
+{
+  return (ctx->write(ctx->write_ctx, buf, len));
+}
+
+int32_t cli_puts(mcli_ctx *ctx, const char *str)
+{
+  return (cli_write(ctx, str, strlen_(str)));
+}
+
+int32_t cli_newline(mcli_ctx *ctx)
+{
+  return (cli_write(ctx, "\r\n", 2));
+}
+
+int32_t cli_println(mcli_ctx *ctx, const char *str)
+{
+  int32_t retval = cli_puts(ctx, str);
+  CHECK(retval);
+  CHECK(cli_newline(ctx));
+  return (retval + 2);
+}
+
+int32_t cli_printf(mcli_ctx *ctx, const char * restrict format_str, ...)
+{
+  va_list args;
+  va_start(args, format_str);
+  int32_t retval = vcbprintf_(ctx->write, ctx->write_ctx, format_str, args);
+  va_end(args);
+  return (retval);
+}
+
+int32_t cli_printfln(mcli_ctx *ctx, const char * restrict format_str, ...)
+{
+  va_list args;
+  va_start(args, format_str);
+  int32_t retval = vcbprintf_(ctx->write, ctx->write_ctx, format_str, args);
+  va_end(args);
+  CHECK(retval);
+  CHECK(cli_newline(ctx));
+  return (retval + 2);
+}
+
+int32_t cli_printf_compiled(mcli_ctx *ctx, printf_format *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int32_t retval = vcbprintf_compiled_(ctx->write, ctx->write_ctx, format, args);
+  va_end(args);
+  return (retval);
+}
+
+int32_t cli_printfln_compiled(mcli_ctx *ctx, printf_format *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int32_t retval = vcbprintf_compiled_(ctx->write, ctx->write_ctx, format, args);
+  va_end(args);
+  CHECK(retval);
+  CHECK(cli_newline(ctx));
+  return (retval + 2);
 }
 
-static int32_t help_cmd(uint32_t argc, char* argv[])
+int32_t cli_frame_reply(mcli_ctx *ctx, const void *data, uint32_t len)
 {
+#if MCLI_FRAMES
+  return (send_frame(ctx, MCLI_FRAME_DATA, data, len));
+#else
+  (void)ctx;
+  (void)data;
+  (void)len;
+  return (-1);
+#endif
+}
+
+// the default session prints the same way as the rest of mprintf
+static int32_t default_write(void *write_ctx, const char *buf, uint32_t len)
+{
+  (void)write_ctx;
+  return (write_(buf, len));
+}
+
+static int32_t help_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[])
+{
+  (void)argc;
+  (void)argv;
   const int32_t cmd_col_width = -20;    // negative number means text will be left-aligned
-  puts_("Command Line Interface ");
+  // printed once for every command, so it is only parsed once
+  PRINTF_FORMAT(help_row, "%*s%s");
+  cli_puts(ctx, "Command Line Interface ");
   // VERSION is defined in the makefile and passed to the compiler
-  println_(VERSION);
+  cli_println(ctx, VERSION);
+
+#if MCLI_HELP_TEXT
+  cli_println(ctx, "The following commands are defined internally. Enter a command without any");
+  cli_println(ctx, "arguments to see usage instructions.");
+  cli_newline(ctx);
+
+  cli_printfln_compiled(ctx, &help_row, cmd_col_width, "Command:", "Description:");
+#endif
+
+  for(const cmdEntry *cmd = __mcli_cmd_start; cmd < __mcli_cmd_end; cmd++){
+    cli_printfln_compiled(ctx, &help_row, cmd_col_width, cmd->cmd_name, cmd->help_text);
+  }
+
+  return (0);
+}
+
+#if MCLI_FRAMES
+// a client can find out which commands there are by running help in a frame
+// each command's name is sent back in its own reply
+static int32_t help_raw(mcli_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+  (void)data;
+  (void)len;
+  for(const cmdEntry *cmd = __mcli_cmd_start; cmd < __mcli_cmd_end; cmd++){
+    uint32_t name_len = 0;
+    while(cmd->cmd_name[name_len] != '\0'){
+      name_len++;
+    }
+    CHECK(cli_frame_reply(ctx, cmd->cmd_name, name_len));
+  }
+  return (0);
+}
+#endif
+
+#if MCLI_STATS
+// every byte a session prints passes through here on its way to the session's own output
+static int32_t stats_write(void *write_ctx, const char *buf, uint32_t len)
+{
+  mcli_ctx *ctx = (mcli_ctx *)write_ctx;
+  int32_t retval = ctx->stats.write(ctx->stats.write_ctx, buf, len);
+  if(retval > 0){
+    ctx->stats.bytesOut += (uint32_t)retval;
+  }
+  return (retval);
+}
 
-  println_("The following commands are defined internally. Enter a command without any");
-  println_("arguments to see usage instructions.");
-  print_newline();
+// this is called by the producer after len characters were pushed into rxBuffer
+static void stats_rx(mcli_ctx *ctx, uint32_t len)
+{
+  ringBuf *buf = &ctx->rxBuffer;
+  uint32_t used = (buf->writeIndex - buf->readIndex) & (buf->size - 1);
+  ctx->stats.bytesIn += len;
+  if(used > ctx->stats.rxPeak){
+    ctx->stats.rxPeak = used;
+  }
+}
+
+// this is called once cmd has finished, to add the cycles it took to its totals
+static void stats_command(mcli_ctx *ctx, const cmdEntry *cmd)
+{
+  uint32_t index = cmd - __mcli_cmd_start;
+  uint32_t cycles = ctx->stats.cmdCycles;
+  ctx->stats.cmdCycles = 0;
+  if(index >= STATS_COMMANDS){
+    return;
+  }
+  cmdStats *entry = &ctx->stats.commands[index];
+  entry->calls++;
+  entry->totalCycles += cycles;
+  if(cycles > entry->maxCycles){
+    entry->maxCycles = cycles;
+  }
+}
 
-  printfln_("%*s%s", cmd_col_width, "Command:", "Description:");
+// returns the number of cycles since the counter was started (wrapping at 32 bits)
+static inline uint32_t cycle_count(void)
+{
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+  // the counter is only started the first time a command is timed
+  if((STATS_DWT_CTRL & STATS_DWT_CYCCNTENA) == 0){
+    STATS_DEMCR |= STATS_DEMCR_TRCENA;
+    STATS_DWT_CYCCNT = 0;
+    STATS_DWT_CTRL |= STATS_DWT_CYCCNTENA;
+  }
+  return (STATS_DWT_CYCCNT);
+#else
+  return (0);
+#endif
+}
 
-  for(uint32_t i = 0; i < COUNT_OF(cmd_table); i++){
-    printfln_("%*s%s", cmd_col_width, cmd_table[i].cmd_name, cmd_table[i].help_text);
+static int32_t stats_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[])
+{
+  (void)argc;
+  (void)argv;
+  const mcli_stats *stats = &ctx->stats;
+  const int32_t name_col_width = -20;   // negative number means text will be left-aligned
+  PRINTF_FORMAT(stats_row, "%*s%10u%12u%12u");
+
+  cli_printfln(ctx, "rx buffer:    %u of %u bytes at most, %u overflows",
+               stats->rxPeak, ctx->rxBuffer.size - 1, ctx->rxBuffer.overflowCount);
+  cli_printfln(ctx, "bytes:        %u in, %u out", stats->bytesIn, stats->bytesOut);
+#if MCLI_HISTORY
+  cli_printfln(ctx, "history:      %u entries, %u of %u bytes, %u evicted",
+               ctx->historyNext - ctx->historyOldest, ctx->historyUsed,
+               ctx->historyDataSize, stats->historyEvictions);
+#endif
+  cli_printfln(ctx, "printf:       %u truncated", printf_truncations_());
+  cli_newline(ctx);
+
+  cli_printfln(ctx, "%*s%10s%12s%12s", name_col_width, "Command:", "calls", "max cycles", "avg cycles");
+  uint32_t index = 0;
+  for(const cmdEntry *cmd = __mcli_cmd_start; (cmd < __mcli_cmd_end) && (index < STATS_COMMANDS); cmd++, index++){
+    const cmdStats *entry = &stats->commands[index];
+    uint32_t avg = (entry->calls > 0) ? (uint32_t)(entry->totalCycles / entry->calls) : 0;
+    cli_printfln_compiled(ctx, &stats_row, name_col_width, cmd->cmd_name, entry->calls, entry->maxCycles, avg);
   }
+  return (0);
+}
+#endif
 
+static int32_t batch_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[])
+{
+  (void)argc;
+  (void)argv;
+  // from here on, cli_process() hands every character to handle_batch_char()
+  ctx->batchMode = true;
+  ctx->batchLineTooLong = false;
+  return (0);
+}
+
+#if MCLI_HISTORY
+static int32_t history_cmd(mcli_ctx *ctx, uint32_t argc, char* argv[])
+{
+  (void)argc;
+  (void)argv;
+  // entries are numbered from 1 for people, and from 0 in historyIndex
+  for(uint32_t number = ctx->historyOldest; number < ctx->historyNext; number++){
+    cli_printf(ctx, "%5u  ", number + 1);
+    history_write(ctx, number);
+    cli_newline(ctx);
+  }
   return (0);
 }
+#endif
 
-static void handle_printable_char(char c)
+static void handle_printable_char(mcli_ctx *ctx, char c)
 {
   // cmdBufRWSize is the largest size usable to hold printable characters
   // 1 byte at the end is reserved for '\0'
-  static const uint32_t cmdBufRWSize = CMD_BUFFER_SIZE - 1;
-  // this escape sequence will shift all chars past the cursor 1 space to the right
-  static const char esc_seq_insert_char[] = "\x1B[@";
+  const uint32_t cmdBufRWSize = ctx->cmdBuffer.size - 1;
 
   // if cmdBuffer is already holding the limit of printable characters
-  if(cmdBuffer.len >= cmdBufRWSize){
+  if(ctx->cmdBuffer.len >= cmdBufRWSize){
     return;
   }
+  // backspaces have to reach the screen before this character does
+  if(ctx->echoDeleteLen > 0){
+    flush_echo(ctx);
+  }
   // determine where the new character should be inserted
-  uint32_t insert_pos = cmdBuffer.len - cmdBuffer.cursorOffset;
+  uint32_t insert_pos = ctx->cmdBuffer.len - ctx->cmdBuffer.cursorOffset;
   // move all the characters past the insertion point 1 space to the right
-  memmove_(&(cmdBuffer.data[insert_pos+1]), &(cmdBuffer.data[insert_pos]), cmdBuffer.cursorOffset + 1);
+  memmove_(&(ctx->cmdBuffer.data[insert_pos+1]), &(ctx->cmdBuffer.data[insert_pos]), ctx->cmdBuffer.cursorOffset + 1);
   // insert the new character into the command buffer and increment length of array
-  cmdBuffer.data[insert_pos] = c;
-  cmdBuffer.len++;
+  ctx->cmdBuffer.data[insert_pos] = c;
+  ctx->cmdBuffer.len++;
 
-  // now handle printing the character to the terminal
-  // if this new character is not being appended to the end of the string
-  if(cmdBuffer.cursorOffset > 0){
-    // send an escape sequence to do the same thing as memmove above: shift all characters right of cursor 1 to the right
-    puts_(esc_seq_insert_char);
-  } 
-  // print the character to the screen
-  putchar_(c);
+  // the character is printed to the terminal by flush_echo(), along with any others typed right after it
+  ctx->echoInsertLen++;
 }
 
-static void handle_escape_char(char c)
+static void handle_escape_char(mcli_ctx *ctx, char c)
 {
+#if MCLI_EDITING
   // this escape sequence moves the cursor 1 space to the right
   static const char esc_seq_cursor_right[] = "\x1B[C";
   // this escape sequence moves the cursor 1 space to the left
   static const char esc_seq_cursor_left[] = "\x1B[D";
+#else
+  // ctx is only needed by the history keys, which may be compiled out too
+  (void)ctx;
+#endif
 
   switch(c){
+#if MCLI_HISTORY
   // cursor up (go back in history)
   case 'A':
-    // if there is no history command currently being displayed
-    if(current_history_cmd == NULL){
-      current_history_cmd = newest_cmd;   // start at the newest command
-    }else if(current_history_cmd->next != NULL){    // otherwise, if we can go to the next oldest command
-      current_history_cmd = current_history_cmd->next;  // do so
+    // if we can go to the next oldest command, do so
+    // (if nothing was being shown, that's the newest command)
+    if(ctx->historyView > ctx->historyOldest){
+      ctx->historyView--;
     }
-    history_display(current_history_cmd);   // display the current command (even if it's NULL)
+    history_display(ctx, ctx->historyView);   // display the current command (even if there isn't one)
     break;
   // cursor down (go forward in history)
   case 'B':
-    // cursor down only does something if we're already navigating history
-    if(current_history_cmd != NULL){
-      current_history_cmd = current_history_cmd->prev;
+    // going past the newest command goes back to showing none
+    if(ctx->historyView < ctx->historyNext){
+      ctx->historyView++;
     }
-    history_display(current_history_cmd);
+    history_display(ctx, ctx->historyView);
     break;
+#endif
+#if MCLI_EDITING
   // cursor right
   case 'C':
     // if not at the end of the line, move cursor right
-    if(cmdBuffer.cursorOffset > 0){
-      cmdBuffer.cursorOffset--;
-      puts_(esc_seq_cursor_right);
+    if(ctx->cmdBuffer.cursorOffset > 0){
+      ctx->cmdBuffer.cursorOffset--;
+      cli_puts(ctx, esc_seq_cursor_right);
     }
     break;
   // cursor left
   case 'D':
     // if not at the beginning of the line, move cursor left
-    if(cmdBuffer.cursorOffset < cmdBuffer.len){
-      cmdBuffer.cursorOffset++;
-      puts_(esc_seq_cursor_left);
+    if(ctx->cmdBuffer.cursorOffset < ctx->cmdBuffer.len){
+      ctx->cmdBuffer.cursorOffset++;
+      cli_puts(ctx, esc_seq_cursor_left);
     }
     break;
+#endif
   default:
     // encountered unsupported character, do nothing
     break;
   }
 }
 
-static void handle_control_char(char c)
+static void handle_control_char(mcli_ctx *ctx, char c)
 {
-  // this escape sequence moves the cursor 1 space to the left, then deletes that character
-  static const char esc_seq_backspace[] = "\x1B[D\x1B[P";
   switch(c){
   case '\n':
-    if(previous_char[0] == '\r'){
+    if(ctx->previous_char[0] == '\r'){
       // newline was already handled from '\r'
       break;
     }// else fall through
   case '\r':
     // enter was pressed, handle it here!
-    print_newline();
-    // if the line wasn't blank, store it and process it
-    if(!isBlank(&cmdBuffer)){
-      history_input(&cmdBuffer);
-      current_history_cmd = NULL;   // reset the history command
-      parse_command();
-    }
-    // reset the command buffer
-    reset_cmdBuffer();
-    print_prompt();
+    cli_newline(ctx);
+#if MCLI_HISTORY
+    // unless the line is an unknown !N, process it (and store it, if it isn't blank)
+    if(history_expand(ctx) >= 0){
+      parse_command(ctx, true);
+    }
+    ctx->historyView = ctx->historyNext;   // reset the history command
+#else
+    parse_command(ctx, true);
+#endif
+    // if the command is still pending, this happens once it finishes
+    if(ctx->runningCmd == NULL){
+      finish_cmd_line(ctx);
+    }
+    break;
+  case CANCEL_CHAR:
+    // Ctrl-C outside of a command throws away the line being typed
+    cli_puts(ctx, "^C");
+    cli_newline(ctx);
+#if MCLI_HISTORY
+    ctx->historyView = ctx->historyNext;
+#endif
+    reset_cmdBuffer(ctx);
+    print_prompt(ctx);
+    break;
+#if MCLI_HISTORY
+  case SEARCH_CHAR:
+    // Ctrl-R starts searching history for whatever is typed next
+    ctx->searchMode = true;
+    ctx->searchLen = 0;
+    ctx->searchText[0] = '\0';
+    ctx->searchMatch = ctx->historyNext;
+    search_display(ctx);
+    break;
+#endif
+#if MCLI_EDITING
+  case '\t':
+    // tab was pressed, try to complete the command name
+    complete_command(ctx);
     break;
+#endif
   case 0x7F:
     // DEL case falls through and is treated the same as the BS case
-  case '\b':
+  case '\b':{
     // backspace was pressed, handle it here
-    // delete the character from the screen
-    puts_(esc_seq_backspace);
+    // there is nothing to delete if the cursor is at the beginning of the line
+    uint32_t insert_pos = ctx->cmdBuffer.len - ctx->cmdBuffer.cursorOffset;
+    if(insert_pos == 0){
+      break;
+    }
+    // characters inserted before this have to reach the screen before they can be deleted from it
+    if(ctx->echoInsertLen > 0){
+      flush_echo(ctx);
+    }
     // remove the character from the command buffer
-    uint32_t insert_pos = cmdBuffer.len - cmdBuffer.cursorOffset;
-    memmove_(&(cmdBuffer.data[insert_pos-1]), &(cmdBuffer.data[insert_pos]), cmdBuffer.cursorOffset + 1);
-    cmdBuffer.len--;
+    memmove_(&(ctx->cmdBuffer.data[insert_pos-1]), &(ctx->cmdBuffer.data[insert_pos]), ctx->cmdBuffer.cursorOffset + 1);
+    ctx->cmdBuffer.len--;
+    // the character is deleted from the screen by flush_echo()
+    ctx->echoDeleteLen++;
     break;
+  }
   default:
     // encountered unsupported character, do nothing
     break;
   }
 }
 
+// bring the terminal up to date with the characters inserted and deleted since the last flush
+// a run of n inserts costs n characters, plus a single insert escape sequence if it's mid-line,
+// and a run of n backspaces costs 2 escape sequences, no matter how big n is
+static void flush_echo(mcli_ctx *ctx)
+{
+  if(ctx->echoInsertLen > 0){
+    // if the characters were not appended to the end of the line, shift everything
+    // right of the cursor over to make room for them, the same as the memmove in handle_printable_char()
+    if(ctx->cmdBuffer.cursorOffset > 0){
+      print_esc_seq(ctx, ctx->echoInsertLen, '@');
+    }
+    // the inserted characters are the ones right before the cursor
+    uint32_t cursor_pos = ctx->cmdBuffer.len - ctx->cmdBuffer.cursorOffset;
+    cli_write(ctx, &ctx->cmdBuffer.data[cursor_pos - ctx->echoInsertLen], ctx->echoInsertLen);
+    ctx->echoInsertLen = 0;
+  }
+  if(ctx->echoDeleteLen > 0){
+    // move the cursor left, then delete that many characters
+    print_esc_seq(ctx, ctx->echoDeleteLen, 'D');
+    print_esc_seq(ctx, ctx->echoDeleteLen, 'P');
+    ctx->echoDeleteLen = 0;
+  }
+}
+
+// print the escape sequence "ESC [ n cmd". n is left out if it is 1, since that's the default
+static void print_esc_seq(mcli_ctx *ctx, uint32_t n, char cmd)
+{
+  if(n == 1){
+    const char esc_seq[3] = {0x1B, '[', cmd};
+    cli_write(ctx, esc_seq, sizeof(esc_seq));
+  }else{
+    cli_printf(ctx, "\x1B[%u%c", n, cmd);
+  }
+}
+
+// in batch mode every line is tokenized and run as soon as its end arrives
+// nothing is echoed, escape sequences aren't handled, and nothing goes into history
+// the only output is whatever the commands print
+static void handle_batch_char(mcli_ctx *ctx, char c)
+{
+  if(c == BATCH_EXIT_CHAR){
+    // leave batch mode. Anything left on the line is thrown away
+    ctx->batchMode = false;
+    ctx->previous_char[0] = 0;
+    ctx->previous_char[1] = 0;
+    reset_cmdBuffer(ctx);
+    print_prompt(ctx);
+  }else if((c == '\r') || (c == '\n')){
+    // "\r\n" just looks like an extra blank line, which is skipped
+    if(ctx->batchLineTooLong){
+      cli_println(ctx, "ERROR: line too long");
+    }else{
+      parse_command(ctx, false);
+    }
+    ctx->batchLineTooLong = false;
+    if(ctx->runningCmd == NULL){
+      finish_cmd_line(ctx);
+    }
+  }else if(isPrintableChar(c) || (c == '\t')){
+    // 1 byte at the end is reserved for '\0'
+    if(ctx->cmdBuffer.len >= (ctx->cmdBuffer.size - 1)){
+      ctx->batchLineTooLong = true;
+      return;
+    }
+    // tabs separate arguments the same as spaces
+    ctx->cmdBuffer.data[ctx->cmdBuffer.len] = (c == '\t') ? ' ' : c;
+    ctx->cmdBuffer.len++;
+    ctx->cmdBuffer.data[ctx->cmdBuffer.len] = '\0';
+  }
+}
+
 // this function returns true if the character is printable, otherwise false
 static inline bool isPrintableChar(char c)
 {
@@ -337,257 +1044,1178 @@ static inline bool isPrintableChar(char c)
   }
 }
 
-// this function returns true if the buffer is blank, otherwise false
-static inline bool isBlank(txtBuf *buf)
-{
-  // look at all characters in the buffer
-  for(uint32_t i = 0; i < buf->len; i++){
-    // as soon as we encounter a character that is printable
-    // (and not space!), we know the buffer isn't blank
-    if((isPrintableChar(buf->data[i])) && (buf->data[i] != ' ')){
-      return false;
-    }
-  }
-  return true;
-}
-
 // reset the state of the command buffer
-static inline void reset_cmdBuffer(void)
+static inline void reset_cmdBuffer(mcli_ctx *ctx)
 {
-    cmdBuffer.data[0] = '\0';
-    cmdBuffer.len = 0;
-    cmdBuffer.cursorOffset = 0;
+    ctx->cmdBuffer.data[0] = '\0';
+    ctx->cmdBuffer.len = 0;
+    ctx->cmdBuffer.cursorOffset = 0;
+    ctx->echoInsertLen = 0;
+    ctx->echoDeleteLen = 0;
 }
 
+#if MCLI_HISTORY || MCLI_LOG
 // clear the text being show on the command line
-static void clear_cmd_line(bool show_prompt)
+static void clear_cmd_line(mcli_ctx *ctx, bool show_prompt)
 {
   // clears the entire line, then resets the cursor to the beginning of the line
   static const char esc_seq_clear_line[] = "\x1B[2K\r";
-  puts_(esc_seq_clear_line);
+  cli_puts(ctx, esc_seq_clear_line);
   if(show_prompt){
-    print_prompt();
+    print_prompt(ctx);
   }
 }
+#endif
 
 // print a prompt to the command line. This tells the user they can input text
-static inline void print_prompt(void)
+static inline void print_prompt(mcli_ctx *ctx)
 {
-  puts_("# ");
+  cli_puts(ctx, "# ");
 }
 
 // parse the command buffer by tokenizing the input string, looking to see
 // if the first word entered matches any known commands, and if so, calling them
-static int32_t parse_command(void)
+// a blank line does nothing. Otherwise, if keep_history is true, the line is stored in history
+static int32_t parse_command(mcli_ctx *ctx, bool keep_history)
 {
-  uint32_t argc;                  // count how many arguments there are
-  char* argv[MAX_NUM_ARGS + 1];   // array size is name of command + max number of arguments
+  // the arguments are kept in ctx, in case the command is still pending when it returns
+  // the words are found before anything is changed, so the line can still go into history as typed
+  tokenEnd ends[MAX_NUM_ARGS + 1];
+  int32_t retval = tokenize_command(ctx->cmdBuffer.data, ctx->cmdBuffer.len, &ctx->argc, ctx->argv, ends);
+  if(ctx->argc == 0){
+    return (0);
+  }
+#if MCLI_HISTORY
+  if(keep_history){
+    history_input(ctx, ctx->cmdBuffer.data, ctx->cmdBuffer.len);
+  }
+#else
+  (void)keep_history;
+#endif
+  if(retval == TOKENIZE_TOO_MANY_ARGS){
+    cli_println(ctx, "ERROR: too many arguments passed");
+    return (-1);
+  }else if(retval == TOKENIZE_OPEN_QUOTE){
+    cli_println(ctx, "ERROR: missing closing quote");
+    return (-1);
+  }
+  terminate_tokens(ctx->argc, ctx->argv, ends);
 
-  int32_t retval = tokenize_command(cmdBuffer.data, &argc, argv);
-  CHECK(retval);
+#ifdef DEBUG
+  check_command_table(ctx);
+#endif
 
   // look for a matching command name
   // and call it
-  for(uint32_t i = 0; i < COUNT_OF(cmd_table); i++){
-    if(strcmp_(argv[0], cmd_table[i].cmd_name) == 0){
-      retval = (cmd_table[i].func_pointer)(argc, argv);
-      CHECK(retval);
-      return(0);
-    }
+  const cmdEntry *cmd = find_command(ctx->argv[0]);
+  if((cmd != NULL) && (cmd->func_pointer == NULL)){
+    cli_println(ctx, "ERROR: command can only be run in a frame");
+    return (-1);
+  }
+  if(cmd != NULL){
+    ctx->runningCmd = cmd;
+    ctx->cancelRequested = false;
+    return (run_command(ctx));
   }
   // if we reach this point it means we searched the whole command table and didn't find a match
-  println_("ERROR: command not found!");
+  cli_println(ctx, "ERROR: command not found!");
   return (-1);
 }
 
-// tokenize the input string. This is accomplished by going through the string
-// and replacing  all spaces (' ') with NULL bytes ('\0')
-static int32_t tokenize_command(char* cmd_buffer, uint32_t* argc, char* argv[])
+// call the running command (again)
+// if it returns MCLI_PENDING, it stays the running command and this returns MCLI_PENDING
+// otherwise the command is finished, and this returns its result
+static int32_t run_command(mcli_ctx *ctx)
 {
-  uint32_t i = 0;
-  // track the previous character we just looked at
-  // initialized to ' ' so we know the first character
-  // found is the start of a token
-  char previous_c = ' ';
-  // initialize c to the beginning of the string
-  char c = cmd_buffer[i];
-  // initialize the number of arguments to 0
-  *argc = 0;
+#if MCLI_STATS
+  uint32_t start = cycle_count();
+#endif
+  int32_t retval = (ctx->runningCmd->func_pointer)(ctx, ctx->argc, ctx->argv);
+#if MCLI_STATS
+  ctx->stats.cmdCycles += cycle_count() - start;
+#endif
+  // a cancelled command doesn't get to keep running, no matter what it returns
+  if((retval == MCLI_PENDING) && (!ctx->cancelRequested)){
+    return (MCLI_PENDING);
+  }
+  if(ctx->cancelRequested){
+    cli_puts(ctx, "^C");
+    cli_newline(ctx);
+    ctx->cancelRequested = false;
+  }
+#if MCLI_STATS
+  stats_command(ctx, ctx->runningCmd);
+#endif
+  ctx->runningCmd = NULL;
+  CHECK(retval);
+  return (0);
+}
 
-  // until we reach the end of the string
-  while(c != '\0'){
-    // if we find the beginning of a new word
-    if((c != ' ') && (previous_c == ' ')){
-      // and we haven't found too many words
-      if((*argc) > MAX_NUM_ARGS){
-        println_("ERROR: too many arguments passed");
-        return (-1);
-      }else{
-        // store the location of this word
-        argv[(*argc)] = &(cmd_buffer[i]);
-        // and increment how many words we've found
-        (*argc)++;
-      }
-    // spaces are turned to NULL ('\0') so when the function reads the
-    // word starting at argv[n], it knows when to stop
-    }else if(c == ' '){
-      cmd_buffer[i] = '\0';
-    }
-    // remember the previous character, increment the count, and do it again
-    previous_c = c;
-    i++;
-    c = cmd_buffer[i];
+// look for Ctrl-C in the characters that arrived while the running command was busy
+// if there is one, the command is cancelled, and the characters up to it are thrown away
+static void check_cancel(mcli_ctx *ctx)
+{
+  if((ctx->runningCmd != NULL) && (!ctx->cancelRequested)){
+    ctx->cancelRequested = bufDiscardThrough(&ctx->rxBuffer, CANCEL_CHAR);
   }
-  // everything was fine so return 0
-  return 0;
 }
 
-/***** History Functions *****/
-// this function clears the current command line and displays a previously-entered command
-static void history_display(cmdHistory *hist_cmd)
+// get the command line ready for the next command once the last one is finished
+static void finish_cmd_line(mcli_ctx *ctx)
 {
-  // reset the command buffer and clear the displayed text
-  reset_cmdBuffer();
-  clear_cmd_line(true);
-  // as long as we're being asked to actually display something, print that to the screen
-  if(hist_cmd != NULL){
-    memcpy_(cmdBuffer.data, &hist_cmd->cmd, (hist_cmd->cmd_len+1));
-    cmdBuffer.len = hist_cmd->cmd_len;
-    puts_(cmdBuffer.data);
+  reset_cmdBuffer(ctx);
+  // the batch command turns off the prompt along with everything else
+  if(!ctx->batchMode){
+    print_prompt(ctx);
   }
 }
 
-// this function takes the entered command and stores it in the history (as long as it isn't an immediate repeat) 
-static void history_input(txtBuf *cmd)
+// binary search the command table for cmd_name
+// returns the matching command entry, or NULL if there isn't one
+static const cmdEntry* find_command(const char *cmd_name)
 {
-  // if the history isn't empty, check for repeats
-  if(newest_cmd != NULL){
-    if(strcmp_(&newest_cmd->cmd, cmd->data) == 0){  // if the command we want to put into history is already newest_cmd, skip
-      return;
+  const cmdEntry *cmd_table = __mcli_cmd_start;
+
+  // the command (if it exists) is somewhere in cmd_table[low] through cmd_table[high-1]
+  uint32_t low = 0;
+  uint32_t high = __mcli_cmd_end - __mcli_cmd_start;
+
+  while(low < high){
+    uint32_t mid = (low + high) >> 1;
+    int32_t cmp = strcmp_(cmd_name, cmd_table[mid].cmd_name);
+    if(cmp == 0){
+      return &cmd_table[mid];
+    }else if(cmp < 0){
+      // cmd_name comes before the middle entry
+      high = mid;
+    }else{
+      // cmd_name comes after the middle entry
+      low = mid + 1;
     }
   }
-  // calculate how many bytes we need to allocate for this new command
-  uint32_t size_req = (sizeof(cmdHistory)-3) + (cmd->len);
+  return NULL;
+}
 
-  // make sure we request bytes in word increments (multiples of 4)
-  // I don't think this is technically necessary, but maintaining word-alignment
-  // means the memory accesses are a lot cleaner
-  while(size_req & 0x03){
-    size_req++;
+#ifdef DEBUG
+// a binary search silently misses commands if the table isn't sorted,
+// so debug builds double-check the linker script sorted it the first time a command is run
+static void check_command_table(mcli_ctx *ctx)
+{
+  static bool table_checked = false;
+  if(!table_checked){
+    for(const cmdEntry *cmd = &__mcli_cmd_start[1]; cmd < __mcli_cmd_end; cmd++){
+      if(strcmp_(cmd[-1].cmd_name, cmd->cmd_name) >= 0){
+        cli_printfln(ctx, "ERROR: command table is not sorted at \"%s\"", cmd->cmd_name);
+      }
+    }
+    table_checked = true;
   }
-  // allocate memory (if possible) to store the new history entry
-  cmdHistory *new_node = (cmdHistory *)history_malloc(size_req);
+}
+#endif
+
+// tokenize the input string (len characters long) by finding where each word starts and ends.
+// words are separated by spaces. Inside double quotes ("a b") spaces don't separate words,
+// and a backslash makes the next character part of the word no matter what it is (\" or \\ or \ ).
+// a blank line has no words, so argc is 0. The string isn't changed: once it is safe to,
+// terminate_tokens() takes out the quotes and escapes and ends each word with a NULL byte ('\0')
+// returns 0 if successful, TOKENIZE_TOO_MANY_ARGS if too many words were found,
+// or TOKENIZE_OPEN_QUOTE if a quote was never closed
+static int32_t tokenize_command(char* cmd_buffer, uint32_t len, uint32_t* argc, char* argv[], tokenEnd ends[])
+{
+  uint32_t i = 0;
+  // initialize the number of arguments to 0
+  *argc = 0;
 
-  // if unable to allocate enough memory, new_node will be NULL
-  while(new_node == NULL){
-    // if the oldest command is NULL, that means the memory is totally empty
-    if(oldest_cmd == NULL){
-      return;   // no room to store the command
-    }else{
-      // free the oldest entry and retry
-      free_oldest_cmd();
-      new_node = (cmdHistory *)history_malloc(size_req);
-    }
-  }
-  // if you reach this point you were able to allocate enough memory to store the command
-  // copy the data from cmdBuffer to the new_node entry
-  new_node->cmd_len = cmd->len;
-  memcpy_(&new_node->cmd, cmd->data, cmd->len);
-  *((char*)&new_node->cmd + cmd->len) = '\0';   // put a null byte on the end of the string
-  // new_node doesn't have any entries newer than it, so prev is NULL
-  new_node->prev = NULL;
-  // new_node is inserted before the newest_cmd entry (which is now technically second-newest)
-  new_node->next = newest_cmd;
-
-  if(newest_cmd == NULL){   // if there aren't any commands in the history yet
-    oldest_cmd = new_node;  // this entry automatically becomes the oldest
-  }else{
-    newest_cmd->prev = new_node;  // otherwise, newest_cmd now has a younger brother
+  while(i < len){
+    // skip to the beginning of the next word
+    i = skip_spaces(cmd_buffer, i, len);
+    if(i >= len){
+      break;
+    }
+    // as long as we haven't found too many words
+    if((*argc) > MAX_NUM_ARGS){
+      return (TOKENIZE_TOO_MANY_ARGS);
+    }
+    // store the location of this word and where it ends
+    argv[(*argc)] = &(cmd_buffer[i]);
+    int32_t word_end = scan_word(cmd_buffer, i, len, &ends[(*argc)]);
+    (*argc)++;
+    CHECK(word_end);
+    i = (uint32_t)word_end;
   }
-
-  newest_cmd = new_node;    // regardless, new_node is now the new newest_cmd
+  // everything was fine so return 0
+  return 0;
 }
 
-// this function allocates memory (if possible) to store previously entered commands
-// if it is unable to provide the requested number of bytes, it returns NULL
-// if able, it returns the memory address
-static void* history_malloc(uint32_t byte_request)
+// this function ends each word with a NULL byte ('\0') so when the command reads
+// the word starting at argv[n], it knows when to stop. The last word ends at the '\0' at the end of the line
+// the quotes and backslashes are taken out of escaped words by moving the rest of the word back over them.
+// a word never gets longer, so it is rewritten in place
+static void terminate_tokens(uint32_t argc, char* argv[], tokenEnd ends[])
 {
-  // this is block of memory reserved for history_malloc to divvy up
-  static uint8_t __attribute__((aligned(4))) memory[HISTORY_SIZE];
-  // we calculate and store the beginning and end of this memory
-  static void *const memory_start = (void *)memory;
-  static void *const memory_end = (void *)memory + HISTORY_SIZE;
-
-
-  void *memory_piece_start; // this points to the start of a memory piece that is (hopefully) big enough
-  void *memory_piece_end;   // this points to the end of that memory piece
-  /*  next_piece_start points to the memory location immediately after the piece we just
-      allocated this variable is static so it persists across function calls. This gives
-      us a hint where to find the next available piece of memory */
-  static void *next_piece_start;  
-
-  // if nothing has been allocated yet, start at the beginning of memory
-  if(newest_cmd == NULL){
-    memory_piece_start = memory_start;
-    memory_piece_end = memory_piece_start + byte_request;
-    if(memory_piece_end <= memory_end){   // if we are not requesting more bytes than HISTORY_SIZE
-      // the next block will probably start at the end of this one
-      next_piece_start = memory_piece_end;
-      return memory_piece_start;
-    }else{
-      // if we are requesting more bytes than HISTORY_SIZE, that's too big
-      return NULL;
-    }
-  }else{    // memory has already been allocated
-    memory_piece_start = next_piece_start;
-    memory_piece_end = memory_piece_start + byte_request;
-    if(newest_cmd >= oldest_cmd){
-      if(memory_piece_end <= memory_end){   // if there is space after the newest_cmd and before memory_end
-        next_piece_start = memory_piece_end;
-        return memory_piece_start;
-      }else if(memory_start + byte_request <= (void*)oldest_cmd){   //otherwise, check for space after memory_start and before oldest_cmd
-        next_piece_start = memory_start + byte_request;
-        return memory_start;
-      }else{
-        return NULL;        // otherwise, not enough memory
-      }
-    }else{  // newest_cmd < oldest_cmd
-      // if the piece of memory we want to allocate does not overlap existing history commands
-      if(memory_piece_end <= (void*)oldest_cmd){
-        next_piece_start = memory_piece_end;
-        return memory_piece_start;
-      }else{
-        return NULL;
+  for(uint32_t i = 0; i < argc; i++){
+    if(!ends[i].escaped){
+      *ends[i].end = '\0';
+      continue;
+    }
+    char *out = argv[i];
+    for(const char *in = argv[i]; in < ends[i].end; in++){
+      if((*in == '\\') && ((in + 1) < ends[i].end)){
+        in++;
+        *out++ = *in;
+      }else if(*in != '"'){
+        *out++ = *in;
       }
     }
+    *out = '\0';
   }
-  // this should never be reached
-  return NULL;
 }
 
-// this function frees the oldest command stored in history to make room for newer commands
-static void free_oldest_cmd(void)
+// this function returns the index of the first character in str at or after i that isn't a space,
+// or len if there isn't one
+// whenever i is word-aligned, a whole word is checked at once, and skipped if it is all spaces
+static uint32_t skip_spaces(const char *str, uint32_t i, uint32_t len)
 {
-  // if the oldest_cmd exists
-  if(oldest_cmd != NULL){
-    oldest_cmd = oldest_cmd->prev;
-    oldest_cmd->next = NULL;
+  while(i < len){
+    if(((((uintptr_t)&str[i]) & 0x03) == 0) && ((len - i) >= sizeof(uint32_t)) &&
+       (*(const aliasWord *)&str[i] == SWAR_SPACES)){
+      i += sizeof(uint32_t);
+      continue;
+    }
+    if(str[i] != ' '){
+      return (i);
+    }
+    i++;
   }
+  return (len);
 }
 
-/***** Buffer Functions *****/
-// this function pushes a byte of data into a ring buffer
-// it returns 0 if successful, otherwise -1
-static int32_t bufPush(ringBuf *buf, uint8_t value)
+// this function finds the end of the word that starts at str[i]: the first space that isn't quoted or escaped,
+// or len. It sets end to where that is, and whether the word has any quotes or backslashes in it
+// whenever i is word-aligned, a whole word is checked at once, and skipped if it has no space, quote or backslash
+// returns the index of the end, or TOKENIZE_OPEN_QUOTE if the word has a quote that is never closed
+static int32_t scan_word(const char *str, uint32_t i, uint32_t len, tokenEnd *end)
 {
+  bool quoted = false;
+  end->escaped = false;
+  while(i < len){
+    if(((((uintptr_t)&str[i]) & 0x03) == 0) && ((len - i) >= sizeof(uint32_t))){
+      uint32_t word = *(const aliasWord *)&str[i];
+      // the character being looked for becomes a 0 byte when the word is XORed with 4 of them
+      if((swar_has_zero(word ^ SWAR_SPACES) | swar_has_zero(word ^ SWAR_QUOTES) |
+          swar_has_zero(word ^ SWAR_BACKSLASHES)) == 0){
+        i += sizeof(uint32_t);
+        continue;
+      }
+    }
+    // there is something to look at in this word (or str isn't aligned here), so check a byte at a time
+    char c = str[i];
+    if(c == '\\'){
+      end->escaped = true;
+      // skip the escaped character too (a backslash at the end of the line is just a backslash)
+      i = ((len - i) >= 2) ? (i + 2) : len;
+      continue;
+    }else if(c == '"'){
+      end->escaped = true;
+      quoted = !quoted;
+    }else if((c == ' ') && (!quoted)){
+      break;
+    }
+    i++;
+  }
+  end->end = (char *)&str[i];
+  if(quoted){
+    return (TOKENIZE_OPEN_QUOTE);
+  }
+  return ((int32_t)i);
+}
+
+// returns nonzero if any byte of word is 0
+// subtracting 1 from a 0 byte borrows and sets its top bit, which ~word only keeps if it wasn't set before
+static inline uint32_t swar_has_zero(uint32_t word)
+{
+  return ((word - SWAR_ONES) & ~word & SWAR_HIGHS);
+}
+
+/***** Frame Functions *****/
+#if MCLI_FRAMES
+// a frame can only start at the beginning of a line, and not in the middle of a history search
+static inline bool frame_can_start(mcli_ctx *ctx, char c)
+{
+#if MCLI_HISTORY
+  if(ctx->searchMode){
+    return (false);
+  }
+#endif
+  return (((uint8_t)c == MCLI_FRAME_SYNC) && (ctx->cmdBuffer.len == 0));
+}
+
+// this function receives a binary frame one byte at a time, and runs it once the whole frame is in
+// the payload goes into cmdBuffer, which is empty whenever a frame starts
+static void handle_frame_char(mcli_ctx *ctx, uint8_t c)
+{
+  switch(ctx->frameState){
+  case FRAME_IDLE:
+    // c is MCLI_FRAME_SYNC
+    ctx->frameCrc = FRAME_CRC_INIT;
+    ctx->frameCount = 0;
+    ctx->frameState = FRAME_LEN_LOW;
+    break;
+  case FRAME_LEN_LOW:
+    ctx->frameLen = c;
+    ctx->frameCrc = crc16_update(ctx->frameCrc, &c, 1);
+    ctx->frameState = FRAME_LEN_HIGH;
+    break;
+  case FRAME_LEN_HIGH:
+    ctx->frameLen |= (uint32_t)c << 8;
+    ctx->frameCrc = crc16_update(ctx->frameCrc, &c, 1);
+    ctx->frameState = (ctx->frameLen > 0) ? FRAME_PAYLOAD : FRAME_CRC_LOW;
+    break;
+  case FRAME_PAYLOAD:
+    // a payload too long for cmdBuffer is still received (so the frame ends in the right place),
+    // it just isn't kept
+    if(ctx->frameCount < ctx->cmdBuffer.size){
+      ctx->cmdBuffer.data[ctx->frameCount] = (char)c;
+    }
+    ctx->frameCrc = crc16_update(ctx->frameCrc, &c, 1);
+    ctx->frameCount++;
+    if(ctx->frameCount == ctx->frameLen){
+      ctx->frameState = FRAME_CRC_LOW;
+    }
+    break;
+  case FRAME_CRC_LOW:
+    ctx->frameRxCrc = c;
+    ctx->frameState = FRAME_CRC_HIGH;
+    break;
+  case FRAME_CRC_HIGH:
+    ctx->frameRxCrc |= (uint16_t)c << 8;
+    ctx->frameState = FRAME_IDLE;
+    run_frame(ctx);
+    break;
+  default:
+    ctx->frameState = FRAME_IDLE;
+    break;
+  }
+}
+
+// this function checks the frame that was just received, and runs the command's raw_func
+// every frame gets either an MCLI_FRAME_DONE or an MCLI_FRAME_ERROR reply
+static void run_frame(mcli_ctx *ctx)
+{
+  uint8_t error = 0;
+  const char *payload = ctx->cmdBuffer.data;
+  uint32_t name_len = 0;
+  const cmdEntry *cmd = NULL;
+
+  if(ctx->frameLen > ctx->cmdBuffer.size){
+    error = MCLI_FRAME_ERR_LENGTH;
+  }else if(ctx->frameCrc != ctx->frameRxCrc){
+    error = MCLI_FRAME_ERR_CRC;
+  }else{
+    // the command name ends at the first '\0'
+    while((name_len < ctx->frameLen) && (payload[name_len] != '\0')){
+      name_len++;
+    }
+    if(name_len >= ctx->frameLen){
+      error = MCLI_FRAME_ERR_FORMAT;
+    }else{
+      cmd = find_command(payload);
+      if(cmd == NULL){
+        error = MCLI_FRAME_ERR_NOT_FOUND;
+      }else if(cmd->raw_func == NULL){
+        error = MCLI_FRAME_ERR_NOT_RAW;
+      }
+    }
+  }
+
+  if(error != 0){
+    send_frame(ctx, MCLI_FRAME_ERROR, &error, 1);
+  }else{
+#if MCLI_STATS
+    uint32_t start = cycle_count();
+#endif
+    int32_t result = cmd->raw_func(ctx, (const uint8_t *)&payload[name_len + 1], ctx->frameLen - name_len - 1);
+#if MCLI_STATS
+    ctx->stats.cmdCycles = cycle_count() - start;
+    stats_command(ctx, cmd);
+#endif
+    uint8_t result_bytes[4] = {
+      (uint8_t)result, (uint8_t)(result >> 8), (uint8_t)(result >> 16), (uint8_t)(result >> 24)
+    };
+    send_frame(ctx, MCLI_FRAME_DONE, result_bytes, sizeof(result_bytes));
+  }
+  reset_cmdBuffer(ctx);
+}
+
+// this function sends a reply frame, with a payload of kind followed by len bytes of data
+// returns 0 if successful, or -1 if data is too long for a frame
+static int32_t send_frame(mcli_ctx *ctx, uint8_t kind, const void *data, uint32_t len)
+{
+  // the length includes kind
+  if(len >= 0xFFFF){
+    return (-1);
+  }
+  uint32_t frame_len = len + 1;
+  uint8_t header[4] = {MCLI_FRAME_SYNC, (uint8_t)frame_len, (uint8_t)(frame_len >> 8), kind};
+  // the sync byte isn't part of the CRC
+  uint16_t crc = crc16_update(FRAME_CRC_INIT, &header[1], sizeof(header) - 1);
+  crc = crc16_update(crc, data, len);
+  uint8_t trailer[2] = {(uint8_t)crc, (uint8_t)(crc >> 8)};
+
+  cli_write(ctx, (const char *)header, sizeof(header));
+  cli_write(ctx, (const char *)data, len);
+  cli_write(ctx, (const char *)trailer, sizeof(trailer));
+  return (0);
+}
+
+// this function adds len bytes of data to a CRC-16/CCITT-FALSE, one bit at a time
+// a table would be faster, but this costs no flash and still keeps up with the UART
+static uint16_t crc16_update(uint16_t crc, const void *data, uint32_t len)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(uint32_t i = 0; i < len; i++){
+    crc ^= (uint16_t)bytes[i] << 8;
+    for(uint32_t bit = 0; bit < 8; bit++){
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ FRAME_CRC_POLY) : (uint16_t)(crc << 1);
+    }
+  }
+  return (crc);
+}
+#endif
+
+/***** Screen Functions *****/
+void cli_screen_init(mcli_screen *screen, char *buffer, uint32_t buffer_size, uint32_t cols)
+{
+  // each row's length is kept in 1 byte
+  if(cols > UINT8_MAX){
+    cols = UINT8_MAX;
+  }
+  // the shadow rows don't need clearing, only the first usedRows of them are ever looked at
+  *screen = (mcli_screen){
+    .shadow = buffer,
+    .rows = buffer_size / (cols + 1),
+    .cols = cols,
+    .drawnRows = 1
+  };
+}
+
+// the frame is drawn by swapping the session's output for screen_write(), so everything
+// the command prints (with cli_printf() or anything else) goes through the comparison
+void cli_screen_begin(mcli_ctx *ctx, mcli_screen *screen)
+{
+  screen->write = ctx->write;
+  screen->write_ctx = ctx->write_ctx;
+  ctx->write = screen_write;
+  ctx->write_ctx = screen;
+  screen->row = 0;
+  screen->col = 0;
+}
+
+void cli_screen_end(mcli_ctx *ctx, mcli_screen *screen)
+{
+  // the last row may not end with a '\n'
+  if(screen->col > 0){
+    screen_end_row(screen);
+  }
+  // anything left over from a taller frame is cleared all at once
+  uint32_t rows = (screen->row < screen->rows) ? screen->row : screen->rows;
+  if(rows < screen->usedRows){
+    screen_move(screen, rows, 0);
+    screen_esc_seq(screen, 0, 'J');
+  }
+  screen->usedRows = rows;
+  screen_move(screen, rows, 0);
+
+  ctx->write = screen->write;
+  ctx->write_ctx = screen->write_ctx;
+}
+
+// this is the print_sink a session uses while a frame is drawn
+static int32_t screen_write(void *write_ctx, const char *buf, uint32_t len)
+{
+  mcli_screen *screen = (mcli_screen *)write_ctx;
+  for(uint32_t i = 0; i < len; i++){
+    screen_char(screen, buf[i]);
+  }
+  return ((int32_t)len);
+}
+
+// this function compares the next character of the frame against the last frame
+// and only sends it if it changed
+static void screen_char(mcli_screen *screen, char c)
+{
+  if(c == '\n'){
+    screen_end_row(screen);
+    return;
+  }
+  // '\r' and other control characters are dropped, and so is anything that doesn't fit
+  if((!isPrintableChar(c)) || (screen->row >= screen->rows) || (screen->col >= screen->cols)){
+    return;
+  }
+
+  char *line = screen_row(screen, screen->row);
+  uint32_t old_len = (screen->row < screen->usedRows) ? (uint8_t)line[0] : 0;
+  uint32_t col = screen->col;
+  screen->col++;
+  if((col < old_len) && (line[1 + col] == c)){
+    return;
+  }
+
+  if((screen->termRow == screen->row) && (screen->termCol < col) &&
+     ((col - screen->termCol) <= SCREEN_REWRITE_GAP)){
+    // everything in the gap matched, so the shadow already holds the new characters
+    screen->write(screen->write_ctx, &line[1 + screen->termCol], col - screen->termCol);
+  }else{
+    screen_move(screen, screen->row, col);
+  }
+  screen->write(screen->write_ctx, &c, 1);
+  line[1 + col] = c;
+  screen->termCol = col + 1;
+}
+
+// this function finishes a row of the frame. If the row got shorter, the end of it is cleared
+static void screen_end_row(mcli_screen *screen)
+{
+  if(screen->row < screen->rows){
+    char *line = screen_row(screen, screen->row);
+    uint32_t old_len = (screen->row < screen->usedRows) ? (uint8_t)line[0] : 0;
+    if(screen->col < old_len){
+      screen_move(screen, screen->row, screen->col);
+      screen_esc_seq(screen, 0, 'K');
+    }
+    line[0] = (char)screen->col;
+  }
+  screen->row++;
+  screen->col = 0;
+}
+
+// this function moves the terminal's cursor to row and col of the frame
+// rows the terminal doesn't have yet are made with newlines, which scroll it if they need to
+static void screen_move(mcli_screen *screen, uint32_t row, uint32_t col)
+{
+  if(row > screen->termRow){
+    uint32_t last_row = screen->drawnRows - 1;
+    if(screen->termRow < last_row){
+      uint32_t down = ((row < last_row) ? row : last_row) - screen->termRow;
+      screen_esc_seq(screen, down, 'B');
+      screen->termRow += down;
+    }
+    while(screen->termRow < row){
+      screen->write(screen->write_ctx, "\r\n", 2);
+      screen->termRow++;
+      screen->termCol = 0;
+    }
+    if(screen->drawnRows <= row){
+      screen->drawnRows = row + 1;
+    }
+  }else if(row < screen->termRow){
+    screen_esc_seq(screen, screen->termRow - row, 'A');
+    screen->termRow = row;
+  }
+
+  if(col == screen->termCol){
+    return;
+  }else if(col == 0){
+    screen->write(screen->write_ctx, "\r", 1);
+  }else if(col > screen->termCol){
+    screen_esc_seq(screen, col - screen->termCol, 'C');
+  }else{
+    screen_esc_seq(screen, screen->termCol - col, 'D');
+  }
+  screen->termCol = col;
+}
+
+// the same as print_esc_seq(), but straight to the session's own output
+// n of 0 (or 1) sends the sequence without a number, which is what ESC[J and ESC[K need
+static void screen_esc_seq(mcli_screen *screen, uint32_t n, char cmd)
+{
+  char esc_seq[16];
+  int32_t len;
+  if(n <= 1){
+    len = snprintf_(esc_seq, sizeof(esc_seq), "\x1B[%c", cmd);
+  }else{
+    len = snprintf_(esc_seq, sizeof(esc_seq), "\x1B[%u%c", n, cmd);
+  }
+  screen->write(screen->write_ctx, esc_seq, (uint32_t)len);
+}
+
+static inline char *screen_row(mcli_screen *screen, uint32_t row)
+{
+  return (&screen->shadow[row * (screen->cols + 1)]);
+}
+
+/***** Completion Functions *****/
+#if MCLI_EDITING
+// complete the command name being typed, if possible
+// if exactly one command matches, the rest of its name is typed out
+// if several commands match, the part they all share is typed out,
+// and if that doesn't add anything, all of the matching names are listed
+static void complete_command(mcli_ctx *ctx)
+{
+  // only the command name (the first word) is completed, and only when the cursor is at the end of it
+  if(ctx->cmdBuffer.cursorOffset != 0){
+    return;
+  }
+  // skip any spaces before the command name
+  const char *prefix = ctx->cmdBuffer.data;
+  while(*prefix == ' '){
+    prefix++;
+  }
+  uint32_t prefix_len = ctx->cmdBuffer.len - (prefix - ctx->cmdBuffer.data);
+  // if there's a space after the command name, an argument is being typed instead
+  for(uint32_t i = 0; i < prefix_len; i++){
+    if(prefix[i] == ' '){
+      return;
+    }
+  }
+
+  // the command table is sorted, so every command starting with prefix
+  // comes right after the first one found
+  const cmdEntry *first = find_first_prefix_match(prefix, prefix_len);
+  if(first == NULL){
+    return;
+  }
+  const cmdEntry *last = first;
+  // common_len is how many characters every matching name has in common
+  uint32_t common_len = strlen_(first->cmd_name);
+  while(((last + 1) < __mcli_cmd_end) &&
+        (prefix_match_len((last + 1)->cmd_name, prefix, prefix_len) == prefix_len)){
+    last++;
+    common_len = prefix_match_len(first->cmd_name, last->cmd_name, common_len);
+  }
+
+  if(common_len > prefix_len){
+    // type out the characters all of the matches share
+    for(uint32_t i = prefix_len; i < common_len; i++){
+      handle_printable_char(ctx, first->cmd_name[i]);
+    }
+    // if the name is complete, add a space so the arguments can be typed right away
+    if(first == last){
+      handle_printable_char(ctx, ' ');
+    }
+  }else if(first != last){
+    // nothing more can be typed out, so list the matches and redraw the command line
+    cli_newline(ctx);
+    for(const cmdEntry *cmd = first; cmd <= last; cmd++){
+      cli_puts(ctx, cmd->cmd_name);
+      cli_puts(ctx, "  ");
+    }
+    cli_newline(ctx);
+    print_prompt(ctx);
+    cli_puts(ctx, ctx->cmdBuffer.data);
+  }
+}
+
+// binary search the command table for the first command that starts with prefix
+// returns the matching command entry, or NULL if there isn't one
+static const cmdEntry* find_first_prefix_match(const char *prefix, uint32_t prefix_len)
+{
+  const cmdEntry *cmd_table = __mcli_cmd_start;
+  // the first command that isn't alphabetically before prefix is somewhere in
+  // cmd_table[low] through cmd_table[high]
+  uint32_t low = 0;
+  uint32_t high = __mcli_cmd_end - __mcli_cmd_start;
+
+  while(low < high){
+    uint32_t mid = (low + high) >> 1;
+    if(strcmp_(cmd_table[mid].cmd_name, prefix) < 0){
+      low = mid + 1;
+    }else{
+      high = mid;
+    }
+  }
+  // if that command doesn't start with prefix, no command does
+  if((low < (uint32_t)(__mcli_cmd_end - __mcli_cmd_start)) &&
+     (prefix_match_len(cmd_table[low].cmd_name, prefix, prefix_len) == prefix_len)){
+    return &cmd_table[low];
+  }
+  return NULL;
+}
+
+// returns how many characters at the start of str1 and str2 match, up to max_len
+static uint32_t prefix_match_len(const char *str1, const char *str2, uint32_t max_len)
+{
+  uint32_t i = 0;
+  while((i < max_len) && (str1[i] != '\0') && (str1[i] == str2[i])){
+    i++;
+  }
+  return i;
+}
+#endif
+
+/***** History Functions *****/
+#if MCLI_HISTORY
+// history entries are at most this long, so their length fits in 1 byte
+#define HISTORY_MAX_LEN   UINT8_MAX
+
+// this function clears the current command line and displays history entry number
+// if number isn't stored (for example, historyNext), the line is left empty
+static void history_display(mcli_ctx *ctx, uint32_t number)
+{
+  // reset the command buffer and clear the displayed text
+  reset_cmdBuffer(ctx);
+  clear_cmd_line(ctx, true);
+  // as long as we're being asked to actually display something, print that to the screen
+  if((number >= ctx->historyOldest) && (number < ctx->historyNext)){
+    ctx->cmdBuffer.len = history_copy(ctx, number, ctx->cmdBuffer.data, ctx->cmdBuffer.size);
+    cli_write(ctx, ctx->cmdBuffer.data, ctx->cmdBuffer.len);
+  }
+}
+
+// this function takes the entered command and stores it in the history (as long as it isn't an immediate repeat)
+// anything that gets stored is also passed to the history save function
+static void history_input(mcli_ctx *ctx, const char *cmd, uint32_t len)
+{
+  if(history_store(ctx, cmd, len) && (ctx->historySave != NULL)){
+    ctx->historySave(ctx, cmd, len);
+  }
+}
+
+// this function adds cmd to the history, freeing the oldest entries until there is room for it
+// returns true if it was stored, or false if it can't fit or repeats the newest entry
+static bool history_store(mcli_ctx *ctx, const char *cmd, uint32_t len)
+{
+  // commands that can never fit are not stored
+  if((ctx->historyEntries == 0) || (len == 0) || (len > HISTORY_MAX_LEN) || ((len + 1) > ctx->historyDataSize)){
+    return (false);
+  }
+  // if the command we want to put into history is already the newest entry, skip
+  if((ctx->historyNext > ctx->historyOldest) && history_matches(ctx, ctx->historyNext - 1, cmd, len, false)){
+    return (false);
+  }
+  // free entries until there is an index slot and enough bytes for this one
+  while(((ctx->historyNext - ctx->historyOldest) >= ctx->historyEntries) ||
+        ((ctx->historyDataSize - ctx->historyUsed) < (len + 1))){
+    free_oldest_cmd(ctx);
+  }
+
+  // write the length, then the characters, wrapping around the end of historyData if needed
+  uint32_t offset = ctx->historyHead;
+  ctx->historyData[offset] = (uint8_t)len;
+  uint32_t text_offset = offset + 1;
+  if(text_offset >= ctx->historyDataSize){
+    text_offset = 0;
+  }
+  uint32_t first_len = ctx->historyDataSize - text_offset;
+  if(first_len > len){
+    first_len = len;
+  }
+  memcpy_(&ctx->historyData[text_offset], cmd, first_len);
+  memcpy_(ctx->historyData, &cmd[first_len], len - first_len);
+
+  ctx->historyIndex[ctx->historyNext % ctx->historyEntries] = (uint16_t)offset;
+  ctx->historyNext++;
+  ctx->historyUsed += len + 1;
+  ctx->historyHead += len + 1;
+  if(ctx->historyHead >= ctx->historyDataSize){
+    ctx->historyHead -= ctx->historyDataSize;
+  }
+  return (true);
+}
+
+// this function copies history entry number into dest (which holds dest_size bytes) and adds a '\0'
+// returns the number of characters copied
+static uint32_t history_copy(mcli_ctx *ctx, uint32_t number, char *dest, uint32_t dest_size)
+{
+  uint32_t offset = ctx->historyIndex[number % ctx->historyEntries];
+  uint32_t len = ctx->historyData[offset];
+  if(len > (dest_size - 1)){
+    len = dest_size - 1;
+  }
+  uint32_t text_offset = offset + 1;
+  if(text_offset >= ctx->historyDataSize){
+    text_offset = 0;
+  }
+  // the text may wrap around the end of historyData
+  uint32_t first_len = ctx->historyDataSize - text_offset;
+  if(first_len > len){
+    first_len = len;
+  }
+  memcpy_(dest, &ctx->historyData[text_offset], first_len);
+  memcpy_(&dest[first_len], ctx->historyData, len - first_len);
+  dest[len] = '\0';
+  return (len);
+}
+
+// this function prints history entry number, without copying it anywhere first
+static void history_write(mcli_ctx *ctx, uint32_t number)
+{
+  uint32_t offset = ctx->historyIndex[number % ctx->historyEntries];
+  uint32_t len = ctx->historyData[offset];
+  uint32_t text_offset = offset + 1;
+  if(text_offset >= ctx->historyDataSize){
+    text_offset = 0;
+  }
+  uint32_t first_len = ctx->historyDataSize - text_offset;
+  if(first_len > len){
+    first_len = len;
+  }
+  cli_write(ctx, (const char *)&ctx->historyData[text_offset], first_len);
+  if(len > first_len){
+    cli_write(ctx, (const char *)ctx->historyData, len - first_len);
+  }
+}
+
+// this function returns true if history entry number is the same as str (len characters long),
+// or if substring is true, if str appears anywhere in it
+static bool history_matches(mcli_ctx *ctx, uint32_t number, const char *str, uint32_t len, bool substring)
+{
+  uint32_t offset = ctx->historyIndex[number % ctx->historyEntries];
+  uint32_t entry_len = ctx->historyData[offset];
+  if((entry_len < len) || ((!substring) && (entry_len != len))){
+    return false;
+  }
+  // try every position str could start at
+  uint32_t last_start = substring ? (entry_len - len) : 0;
+  for(uint32_t start = 0; start <= last_start; start++){
+    uint32_t pos = offset + 1 + start;
+    uint32_t i = 0;
+    while(i < len){
+      if(pos >= ctx->historyDataSize){
+        pos -= ctx->historyDataSize;
+      }
+      if(ctx->historyData[pos] != (uint8_t)str[i]){
+        break;
+      }
+      pos++;
+      i++;
+    }
+    if(i == len){
+      return true;
+    }
+  }
+  return false;
+}
+
+// this function frees the oldest command stored in history to make room for newer commands
+static void free_oldest_cmd(mcli_ctx *ctx)
+{
+  // if the oldest entry exists
+  if(ctx->historyNext > ctx->historyOldest){
+    uint32_t offset = ctx->historyIndex[ctx->historyOldest % ctx->historyEntries];
+    ctx->historyUsed -= ctx->historyData[offset] + 1;
+    ctx->historyOldest++;
+#if MCLI_STATS
+    ctx->stats.historyEvictions++;
+#endif
+  }
+}
+
+// if the command line is "!N", this function replaces it with history entry N
+// "!!" means the newest entry, and "!-N" means N entries ago
+// returns 0 if the command line is ready to run, or -1 if the entry doesn't exist
+static int32_t history_expand(mcli_ctx *ctx)
+{
+  const char *str = ctx->cmdBuffer.data;
+  while(*str == ' '){
+    str++;
+  }
+  if(*str != '!'){
+    return (0);
+  }
+  str++;
+
+  bool relative = false;
+  uint32_t n = 0;
+  uint32_t digits = 0;
+  if(*str == '!'){
+    relative = true;
+    n = 1;
+    str++;
+  }else{
+    if(*str == '-'){
+      relative = true;
+      str++;
+    }
+    while((*str >= '0') && (*str <= '9') && (digits < 9)){
+      n = (n * 10) + (*str - '0');
+      str++;
+      digits++;
+    }
+    if(digits == 0){
+      return (0);   // something like "!abc" isn't history, it is a command
+    }
+  }
+  while(*str == ' '){
+    str++;
+  }
+  if(*str != '\0'){
+    return (0);
+  }
+
+  // entries are numbered from 1 for people, and from 0 in historyIndex
+  uint32_t number = relative ? (ctx->historyNext - n) : (n - 1);
+  if((n == 0) || (n > ctx->historyNext) || (number < ctx->historyOldest) || (number >= ctx->historyNext)){
+    cli_println(ctx, "ERROR: history entry not found");
+    return (-1);
+  }
+  // show what is about to be run
+  ctx->cmdBuffer.len = history_copy(ctx, number, ctx->cmdBuffer.data, ctx->cmdBuffer.size);
+  ctx->cmdBuffer.cursorOffset = 0;
+  cli_println(ctx, ctx->cmdBuffer.data);
+  return (0);
+}
+#endif
+
+/***** History Search Functions *****/
+#if MCLI_HISTORY
+// while searching, each character typed is added to the search text, and the newest entry containing
+// it is shown. Ctrl-R finds the next older match, backspace shortens the search text, and Ctrl-C gives up.
+// anything else ends the search with the match on the command line, then is handled normally,
+// so enter runs the match and the arrow keys start editing it
+// returns true if the character was used by the search
+static bool handle_search_char(mcli_ctx *ctx, char c)
+{
+  if(c == SEARCH_CHAR){
+    // look for an older match
+    if(ctx->searchMatch != ctx->historyNext){
+      search_history(ctx, ctx->searchMatch);
+    }
+  }else if((c == '\b') || (c == 0x7F)){
+    if(ctx->searchLen > 0){
+      ctx->searchLen--;
+      ctx->searchText[ctx->searchLen] = '\0';
+    }
+    // a shorter search text may match something newer again
+    search_history(ctx, ctx->historyNext);
+  }else if(c == CANCEL_CHAR){
+    search_finish(ctx, false);
+    return true;
+  }else if(isPrintableChar(c)){
+    if(ctx->searchLen < (HISTORY_SEARCH_SIZE - 1)){
+      ctx->searchText[ctx->searchLen] = c;
+      ctx->searchLen++;
+      ctx->searchText[ctx->searchLen] = '\0';
+    }
+    // the current match may still contain the longer search text
+    uint32_t start = (ctx->searchMatch != ctx->historyNext) ? (ctx->searchMatch + 1) : ctx->historyNext;
+    search_history(ctx, start);
+  }else{
+    search_finish(ctx, true);
+    return false;
+  }
+  search_display(ctx);
+  return true;
+}
+
+// look for the newest entry older than start that contains the search text
+// searchMatch is set to it, or to historyNext if there isn't one
+static void search_history(mcli_ctx *ctx, uint32_t start)
+{
+  ctx->searchMatch = ctx->historyNext;
+  if(ctx->searchLen == 0){
+    return;
+  }
+  for(uint32_t number = start; number > ctx->historyOldest; number--){
+    if(history_matches(ctx, number - 1, ctx->searchText, ctx->searchLen, true)){
+      ctx->searchMatch = number - 1;
+      return;
+    }
+  }
+}
+
+// redraw the command line with the search text and the current match
+static void search_display(mcli_ctx *ctx)
+{
+  clear_cmd_line(ctx, false);
+  if((ctx->searchLen > 0) && (ctx->searchMatch == ctx->historyNext)){
+    cli_puts(ctx, "(failed reverse-i-search)'");
+  }else{
+    cli_puts(ctx, "(reverse-i-search)'");
+  }
+  cli_write(ctx, ctx->searchText, ctx->searchLen);
+  cli_puts(ctx, "': ");
+  if(ctx->searchMatch != ctx->historyNext){
+    history_write(ctx, ctx->searchMatch);
+  }
+}
+
+// stop searching, and redraw the command line with the match on it (if keep_match is true) or empty
+static void search_finish(mcli_ctx *ctx, bool keep_match)
+{
+  ctx->searchMode = false;
+  uint32_t number = keep_match ? ctx->searchMatch : ctx->historyNext;
+  // up and down continue from the match
+  ctx->historyView = number;
+  history_display(ctx, number);
+}
+#endif
+
+/***** Log Functions *****/
+#if MCLI_LOG
+// claims num_words of the log ring for a new line, and puts the index of the first one in *start
+// returns 0 if successful, or -1 if there isn't room (the line is counted as dropped)
+static int32_t log_reserve(uint32_t num_words, uint32_t *start)
+{
+  uint32_t index = __atomic_load_n(&logBuffer.reserveIndex, __ATOMIC_RELAXED);
+  while(1){
+    uint32_t readIndex = logBuffer.readIndex;
+    if(((index - readIndex) + num_words) > LOG_WORDS){
+      // if other lines were added since index was read, readIndex may have moved past it, so check again
+      uint32_t latest = __atomic_load_n(&logBuffer.reserveIndex, __ATOMIC_RELAXED);
+      if(latest != index){
+        index = latest;
+        continue;
+      }
+      log_drop();
+      return (-1);
+    }
+    // this only succeeds if no other producer claimed space since index was read. If one did,
+    // index is updated and the space is checked again. On the Cortex-M4 this is an LDREX/STREX loop,
+    // so an interrupt that adds a line in between just makes it go around once more
+    if(__atomic_compare_exchange_n(&logBuffer.reserveIndex, &index, index + num_words, true,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+      break;
+    }
+  }
+  *start = index;
+  return (0);
+}
+
+// marks the line at start as ready to print, now that everything after its header has been written
+static void log_commit(uint32_t start, uintptr_t header)
+{
+  // make sure the line lands in memory before the consumer can see its header
+  MEMORY_BARRIER();
+  logBuffer.words[start & (LOG_WORDS - 1)] = header | LOG_READY;
+  if(defaultCtx.notify != NULL){
+    defaultCtx.notify(&defaultCtx);
+  }
+}
+
+// counts a line that didn't fit. Producers can interrupt each other, so the count is updated atomically
+static void log_drop(void)
+{
+  __atomic_fetch_add(&logBuffer.dropped, 1, __ATOMIC_RELAXED);
+  if(defaultCtx.notify != NULL){
+    defaultCtx.notify(&defaultCtx);
+  }
+}
+
+// returns true if there is something in the log that log_flush() can print now
+// a running command (or a frame) isn't interrupted, so lines wait until it's done
+static bool log_ready(mcli_ctx *ctx)
+{
+  if(ctx->runningCmd != NULL){
+    return (false);
+  }
+#if MCLI_FRAMES
+  if(ctx->frameState != FRAME_IDLE){
+    return (false);
+  }
+#endif
+  return (((logBuffer.words[logBuffer.readIndex & (LOG_WORDS - 1)] & LOG_READY) != 0) ||
+          (logBuffer.dropped != logBuffer.droppedHandled));
+}
+
+// prints every line in the log on its own line, then draws the command line again underneath them
+static void log_flush(mcli_ctx *ctx)
+{
+  if(!log_ready(ctx)){
+    return;
+  }
+  flush_echo(ctx);
+  // in batch mode nothing is echoed, so there's nothing to draw again
+  if(!ctx->batchMode){
+    clear_cmd_line(ctx, false);
+  }
+
+  // only the lines that were there when this started are printed, so a busy producer can't keep this going
+  uint32_t readIndex = logBuffer.readIndex;
+  const uint32_t reserveIndex = __atomic_load_n(&logBuffer.reserveIndex, __ATOMIC_RELAXED);
+  while(readIndex != reserveIndex){
+    uintptr_t header = logBuffer.words[readIndex & (LOG_WORDS - 1)];
+    // lines are printed in order, so a line that is still being written holds up the ones after it
+    if((header & LOG_READY) == 0){
+      break;
+    }
+    // don't read the rest of the line until after its header says it's there
+    MEMORY_BARRIER();
+    uint32_t num_words = log_print_line(ctx, readIndex, header);
+    cli_newline(ctx);
+    // clear the line, so none of its words look like a ready header when they are reused
+    for(uint32_t i = 0; i < num_words; i++){
+      logBuffer.words[(readIndex + i) & (LOG_WORDS - 1)] = 0;
+    }
+    // finish with the words before producers can see they are free
+    MEMORY_BARRIER();
+    readIndex += num_words;
+    logBuffer.readIndex = readIndex;
+  }
+
+  uint32_t dropped = logBuffer.dropped;
+  if(dropped != logBuffer.droppedHandled){
+    cli_printfln(ctx, "ERROR: log overflowed, %u lines dropped", dropped - logBuffer.droppedHandled);
+    logBuffer.droppedHandled = dropped;
+  }
+
+  if(!ctx->batchMode){
+    redraw_cmd_line(ctx);
+  }
+}
+
+// prints the log line that starts at word start (without a line ending)
+// returns how many words the line takes up
+static uint32_t log_print_line(mcli_ctx *ctx, uint32_t start, uintptr_t header)
+{
+  uint32_t len = header & LOG_LEN_MASK;
+
+  if((header & LOG_FORMAT) != 0){
+    const char *format_str = (const char *)logBuffer.words[(start + 1) & (LOG_WORDS - 1)];
+    uintptr_t args[LOG_MAX_ARGS];
+    for(uint32_t i = 0; i < len; i++){
+      args[i] = logBuffer.words[(start + 2 + i) & (LOG_WORDS - 1)];
+    }
+    cbprintf_args_(ctx->write, ctx->write_ctx, format_str, args, len);
+    return (2 + len);
+  }
+
+  // the text may wrap around the end of the ring
+  const char *bytes = (const char *)logBuffer.words;
+  uint32_t offset = ((start + 1) & (LOG_WORDS - 1)) * LOG_WORD_SIZE;
+  uint32_t first_len = sizeof(logBuffer.words) - offset;
+  if(first_len > len){
+    first_len = len;
+  }
+  cli_write(ctx, &bytes[offset], first_len);
+  if(len > first_len){
+    cli_write(ctx, bytes, len - first_len);
+  }
+  return (1 + ((len + LOG_WORD_SIZE - 1) / LOG_WORD_SIZE));
+}
+
+// draws the prompt and the command line again on a cleared line, with the cursor where it was
+static void redraw_cmd_line(mcli_ctx *ctx)
+{
+#if MCLI_HISTORY
+  if(ctx->searchMode){
+    search_display(ctx);
+    return;
+  }
+#endif
+  print_prompt(ctx);
+  cli_write(ctx, ctx->cmdBuffer.data, ctx->cmdBuffer.len);
+  if(ctx->cmdBuffer.cursorOffset > 0){
+    print_esc_seq(ctx, ctx->cmdBuffer.cursorOffset, 'D');
+  }
+}
+#endif
+
+/***** Buffer Functions *****/
+// this function pushes a byte of data into a ring buffer
+// it returns 0 if successful, otherwise -1
+static int32_t bufPush(ringBuf *buf, uint8_t value)
+{
+  uint32_t writeIndex = buf->writeIndex;
   // assuming the buffer size is a power of 2, 
   // modulus isn't needed to wrap the index
-  uint32_t nextWI = (buf->writeIndex + 1) & (buf->size - 1);
+  uint32_t nextWI = (writeIndex + 1) & (buf->size - 1);
   // as long as the next write index isn't the read index
   if(nextWI != buf->readIndex){
-    // write the value and increment the write index
-    buf->data[buf->writeIndex] = value;
+    // write the value, make sure it lands in memory before the consumer
+    // can see the new write index, then increment the write index
+    buf->data[writeIndex] = value;
+    MEMORY_BARRIER();
     buf->writeIndex = nextWI;
     return (0);
   }else{  // if the next write index is the read index, buffer is full
@@ -595,6 +2223,31 @@ static int32_t bufPush(ringBuf *buf, uint8_t value)
   }
 }
 
+// this function pushes as many bytes of data into a ring buffer as will fit
+// it returns the number of bytes pushed
+static uint32_t bufPushBlock(ringBuf *buf, const uint8_t *data, uint32_t len)
+{
+  uint32_t writeIndex = buf->writeIndex;
+  // one slot is always left empty so a full buffer can be told apart from an empty one
+  uint32_t space = (buf->readIndex - writeIndex - 1) & (buf->size - 1);
+  if(len > space){
+    len = space;
+  }
+  // the data may have to wrap around the end of the buffer
+  uint32_t first_len = buf->size - writeIndex;
+  if(first_len > len){
+    first_len = len;
+  }
+  memcpy_(&(buf->data[writeIndex]), data, first_len);
+  memcpy_(buf->data, &data[first_len], len - first_len);
+  // make sure the data lands in memory before the consumer can see the new write index
+  MEMORY_BARRIER();
+  // assuming the buffer size is a power of 2, 
+  // modulus isn't needed to wrap the index
+  buf->writeIndex = (writeIndex + len) & (buf->size - 1);
+  return (len);
+}
+
 // this function pops a byte of data out of the ring buffer
 // if the buffer has data, it returns the value at the read index
 // if the buffer is empty, it returns 0
@@ -602,19 +2255,43 @@ static uint8_t bufPop(ringBuf *buf)
 {
   // initialize the return value with a default value of 0
   uint8_t retval = 0;
+  uint32_t readIndex = buf->readIndex;
   // if the read and write index don't match, the buffer contains data
-  if(buf->readIndex != buf->writeIndex){
+  if(readIndex != buf->writeIndex){
+    // don't read the data until after the write index says it's there
+    MEMORY_BARRIER();
     // retrieve the data from the read index
-    retval = buf->data[buf->readIndex];
+    retval = buf->data[readIndex];
+    // finish reading the data before the producer can see the slot is free
+    MEMORY_BARRIER();
     // increment the read index
     // assuming the buffer size is a power of 2, 
     // modulus isn't needed to wrap the index
-    buf->readIndex = (buf->readIndex + 1) & (buf->size - 1);
+    buf->readIndex = (readIndex + 1) & (buf->size - 1);
   }
   // regardless of if the buffer is empty, return retval
   return(retval);
 }
 
+// this function looks for value in the ring buffer without removing anything
+// if it is found, everything up to and including it is removed, and this returns true
+// otherwise the buffer is left alone and this returns false
+static bool bufDiscardThrough(ringBuf *buf, uint8_t value)
+{
+  uint32_t writeIndex = buf->writeIndex;
+  // don't read the data until after the write index says it's there
+  MEMORY_BARRIER();
+  for(uint32_t i = buf->readIndex; i != writeIndex; i = (i + 1) & (buf->size - 1)){
+    if(buf->data[i] == value){
+      // finish reading the data before the producer can see the slots are free
+      MEMORY_BARRIER();
+      buf->readIndex = (i + 1) & (buf->size - 1);
+      return true;
+    }
+  }
+  return false;
+}
+
 // this function returns true if the buffer is empty and false if not
 static bool bufIsEmpty(ringBuf *buf)
 {